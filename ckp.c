@@ -0,0 +1,172 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Checkpoints of a network's training state, so that a long training run survives a restart.
+ * The trainer snapshots its state into one of two buffers, a memory copy, and a writer thread writes it out while the trainer goes on with the other;
+ * if the writer is still busy with the last checkpoint when the next one is due, the trainer skips that one rather than wait for the disk.
+ * Each checkpoint is written into a temporary file, which then replaces the checkpoint file, so a crash mid-write leaves the last checkpoint whole.
+ * File layout:
+ * offset  size  field
+ *  0      8     magic "NNCHECKP"
+ *  8      4     version
+ * 12      4     tag
+ * 16      8     length of the state that follows (in bytes)
+ * 24      ..    state, as the network put it; see ckpput() */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "csv.h"
+#include "ckp.h"
+
+#define MAGIC "NNCHECKP"
+#define VERSION 1
+
+static void store(const Ckp* ck, int b) {
+  /* Write buffer b into the checkpoint file, by way of a temporary file. */
+  char tmp[FLDSIZ + 4];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ck->file);
+  FILE* fo = fopen(tmp, "w");
+  if (fo == NULL) {
+    fprintf(stderr, "ERROR: cannot save checkpoint file %s\n", tmp);
+    exit(1);
+  }
+  const uint32_t v = VERSION;
+  const int32_t tag = ck->tag;
+  const uint64_t n = ck->len[b];
+  fwrite(MAGIC, 1, 8, fo);
+  fwrite(&v, sizeof(v), 1, fo);
+  fwrite(&tag, sizeof(tag), 1, fo);
+  fwrite(&n, sizeof(n), 1, fo);
+  fwrite(ck->buf[b], 1, ck->len[b], fo);
+  if (fflush(fo) != 0 || fsync(fileno(fo)) != 0 || ferror(fo) || fclose(fo) != 0 || rename(tmp, ck->file) != 0) {
+    fprintf(stderr, "ERROR: cannot save checkpoint file %s\n", ck->file);
+    exit(1);
+  }
+}
+
+static void* writer(void* arg) {
+  /* Write each posted buffer, until the checkpoints end. */
+  Ckp* ck = arg;
+  pthread_mutex_lock(&ck->mx);
+  for (;;) {
+    while (!ck->quit && !ck->posted) pthread_cond_wait(&ck->cv, &ck->mx);
+    if (!ck->posted) break; // quit, with nothing left to write
+    const int b = 1 - ck->back;
+    pthread_mutex_unlock(&ck->mx);
+    store(ck, b);
+    pthread_mutex_lock(&ck->mx);
+    ck->posted = false;
+    pthread_cond_broadcast(&ck->cv);
+  }
+  pthread_mutex_unlock(&ck->mx);
+  return NULL;
+}
+
+Ckp* ckpnew(const char* file, int every, int tag) {
+  /* Start checkpointing into the file every so many cycles, and start the writer thread. */
+  Ckp* ck = calloc(1, sizeof(Ckp));
+  ck->file = strndup(file, FLDSIZ); // malloc()
+  ck->every = every < 1 ? 1 : every;
+  ck->tag = tag;
+  for (int b = 0; b < 2; b++) {
+    ck->cap[b] = 4096;
+    ck->buf[b] = malloc(ck->cap[b]);
+  }
+  ck->writer = true;
+  pthread_mutex_init(&ck->mx, NULL);
+  pthread_cond_init(&ck->cv, NULL);
+  pthread_create(&ck->th, NULL, writer, ck);
+  return ck;
+}
+
+void ckpdel(Ckp* ck) {
+  /* Wait for the last checkpoint to be written, stop the writer thread, and destroy the checkpoints; the checkpoint file stays. */
+  if (ck->writer) {
+    pthread_mutex_lock(&ck->mx);
+    ck->quit = true;
+    pthread_cond_signal(&ck->cv);
+    pthread_mutex_unlock(&ck->mx);
+    pthread_join(ck->th, NULL);
+    pthread_cond_destroy(&ck->cv);
+    pthread_mutex_destroy(&ck->mx);
+  }
+  for (int b = 0; b < 2; b++) {
+    free(ck->buf[b]);
+    ck->buf[b] = NULL;
+  }
+  free(ck->file);
+  ck->file = NULL;
+  free(ck);
+}
+
+bool ckpbegin(Ckp* ck, int c) {
+  /* Return true if a checkpoint is due after cycle c and the back buffer is free, and empty the back buffer for ckpput(). */
+  if ((c + 1) % ck->every != 0) return false;
+  pthread_mutex_lock(&ck->mx);
+  const bool busy = ck->posted;
+  pthread_mutex_unlock(&ck->mx);
+  if (busy) {
+    ck->skipped++;
+    return false;
+  }
+  ck->len[ck->back] = 0;
+  return true;
+}
+
+void ckpput(Ckp* ck, const void* p, size_t n) {
+  /* Append n bytes at p to the checkpoint being taken. */
+  const int b = ck->back;
+  if (ck->len[b] + n > ck->cap[b]) {
+    while (ck->len[b] + n > ck->cap[b]) ck->cap[b] *= 2;
+    ck->buf[b] = realloc(ck->buf[b], ck->cap[b]);
+  }
+  memcpy(ck->buf[b] + ck->len[b], p, n);
+  ck->len[b] += n;
+}
+
+void ckpend(Ckp* ck) {
+  /* Hand the checkpoint taken to the writer thread, and return at once. */
+  pthread_mutex_lock(&ck->mx);
+  ck->back = 1 - ck->back;
+  ck->posted = true;
+  pthread_cond_signal(&ck->cv);
+  pthread_mutex_unlock(&ck->mx);
+}
+
+Ckp* ckpopen(const char* file) {
+  /* Read the checkpoint file for ckpget(); return NULL if there is none. */
+  FILE* fi = fopen(file, "r");
+  if (fi == NULL) return NULL;
+  char magic[8];
+  uint32_t v;
+  int32_t tag;
+  uint64_t n;
+  if (fread(magic, 1, 8, fi) != 8 || memcmp(magic, MAGIC, 8) != 0 || fread(&v, sizeof(v), 1, fi) != 1 || v != VERSION ||
+      fread(&tag, sizeof(tag), 1, fi) != 1 || fread(&n, sizeof(n), 1, fi) != 1) {
+    fprintf(stderr, "ERROR: %s is not a checkpoint file\n", file);
+    exit(1);
+  }
+  Ckp* ck = calloc(1, sizeof(Ckp));
+  ck->file = strndup(file, FLDSIZ); // malloc()
+  ck->tag = tag;
+  ck->len[0] = ck->cap[0] = n;
+  ck->buf[0] = malloc(n > 0 ? n : 1);
+  if (fread(ck->buf[0], 1, n, fi) != n) {
+    fprintf(stderr, "ERROR: checkpoint file %s is truncated\n", file);
+    exit(1);
+  }
+  fclose(fi);
+  return ck;
+}
+
+void ckpget(Ckp* ck, void* p, size_t n) {
+  /* Read the next n bytes of the opened checkpoint into p. */
+  if (ck->at + n > ck->len[0]) {
+    fprintf(stderr, "ERROR: checkpoint file %s is truncated\n", ck->file);
+    exit(1);
+  }
+  memcpy(p, ck->buf[0] + ck->at, n);
+  ck->at += n;
+}
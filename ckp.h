@@ -0,0 +1,37 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_CKP_H
+#define NN_CKP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct Ckp { // checkpoints of a network's training state, written by a background thread
+  char* file; // checkpoint file; each checkpoint replaces the last one whole
+  int every; // number of training cycles between checkpoints
+  int tag; // caller's tag, stored in every checkpoint; lirmain's trial number
+  char* buf[2]; // double buffer; the trainer fills one while the writer thread writes the other
+  size_t len[2]; // length of buf[b] (in bytes)
+  size_t cap[2]; // capacity of buf[b] (in bytes)
+  int back; // buffer that the trainer fills next
+  size_t at; // read position in buf[0] of a checkpoint opened by ckpopen()
+  long skipped; // number of checkpoints skipped because the writer was still busy with the last one
+  bool writer; // the writer thread runs; false for a checkpoint opened by ckpopen()
+  pthread_t th; // writer thread
+  pthread_mutex_t mx; // guards the fields below
+  pthread_cond_t cv; // signals a posted or a written buffer
+  bool posted; // buf[1 - back] waits for, or is being written by, the writer thread
+  bool quit; // writer thread exits
+} Ckp;
+
+extern Ckp* ckpnew(const char* file, int every, int tag);
+extern void ckpdel(Ckp* ck);
+extern bool ckpbegin(Ckp* ck, int c);
+extern void ckpput(Ckp* ck, const void* p, size_t n);
+extern void ckpend(Ckp* ck);
+extern Ckp* ckpopen(const char* file);
+extern void ckpget(Ckp* ck, void* p, size_t n);
+
+#endif // NN_CKP_H
@@ -47,11 +47,12 @@ void csvload(Csv* csv) {
   }
   // count records
   char rec[RECSIZ];
+  char* z; // strtok_r() state; concurrent trials load their CSV files at once
   csv->R = 0;
   csv->F = 0;
   while (fgets(rec, sizeof(rec), fi) != NULL) {
     csv->R++;
-    if (csv->F == 0) for (char* s = rec; strtok(s, ",\n\r") != NULL; s = NULL) csv->F++;
+    if (csv->F == 0) for (char* s = rec; strtok_r(s, ",\n\r", &z) != NULL; s = NULL) csv->F++;
   }
   rewind(fi);
   // load records
@@ -63,7 +64,7 @@ void csvload(Csv* csv) {
     }
     csv->r[r] = malloc(csv->F * sizeof(char*));
     int f = 0;
-    for (char* t, * s = rec; (t = strtok(s, ",\n\r")) != NULL; s = NULL) csv->r[r][f++] = strndup(unquote(t), FLDSIZ); // malloc()
+    for (char* t, * s = rec; (t = strtok_r(s, ",\n\r", &z)) != NULL; s = NULL) csv->r[r][f++] = strndup(unquote(t), FLDSIZ); // malloc()
   }
   fclose(fi);
 }
@@ -77,4 +78,21 @@ void csvsave(Csv* csv) {
   for (int r = 0; r < csv->R; r++)
     for (int f = 0; f < csv->F; f++) fprintf(fo, "%s%s", f == 0 ? "" : ",", csv->r[r][f]);
   fclose(fo);
-}
\ No newline at end of file
+}
+
+const char* csvget(const Csv* csv, int r, const char* key) {
+  /* Return record r's field under the header key in record 0, or NULL if there is no such column. */
+  for (int f = 0; f < csv->F; f++)
+    if (strcmp(csv->r[0][f], key) == 0) return csv->r[r][f];
+  return NULL;
+}
+bool csvput(Csv* csv, int r, const char* key, const char* val) {
+  /* Replace record r's field under the header key in record 0 with val, or return false if there is no such column. */
+  for (int f = 0; f < csv->F; f++)
+    if (strcmp(csv->r[0][f], key) == 0) {
+      free(csv->r[r][f]);
+      csv->r[r][f] = strndup(val, FLDSIZ); // malloc()
+      return true;
+    }
+  return false;
+}
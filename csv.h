@@ -4,6 +4,8 @@
 #ifndef NN_CSV_H
 #define NN_CSV_H
 
+#include <stdbool.h>
+
 #define RECSIZ 16384 // CSV record size (in bytes)
 #define FLDSIZ 256 // CSV field size (in bytes)
 
@@ -18,5 +20,7 @@ extern Csv* csvnew(const char* name);
 extern void csvdel(Csv* csv);
 extern void csvload(Csv* csv);
 extern void csvsave(Csv* csv);
+extern const char* csvget(const Csv* csv, int r, const char* key);
+extern bool csvput(Csv* csv, int r, const char* key, const char* val);
 
 #endif // NN_CSV_H
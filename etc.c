@@ -5,7 +5,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
 #include "etc.h"
+#include "ker.h"
 
 inline bool iszero(double x) {
   /* Due to the imprecision of the FPU's representation of real numbers,
@@ -25,14 +27,50 @@ inline double sumsqre(double a, double c) {
   return a + sqre(c);
 }
 
+static _Thread_local unsigned int rng; // this thread's own random seed
+static _Thread_local bool seeded = false; // this thread draws from rng instead of random()
+
+double now(void) {
+  /* Monotonic time (in seconds). */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+void rngseed(unsigned int seed) {
+  /* Give the calling thread a random sequence of its own, so that concurrent trials are reproducible and do not disturb each other. */
+  rng = seed;
+  seeded = true;
+}
+
+unsigned int rngstate(void) {
+  /* Return the calling thread's random state, for rngseed() to resume its sequence where it stands; meaningful only after rngseed(). */
+  return rng;
+}
+
+long rnd(void) {
+  /* Return a random number in the range [0, RAND_MAX], from the thread's own sequence if it has one, else from random(). */
+  return seeded ? rand_r(&rng) : random();
+}
+
 inline double randin(double lo, double hi) {
   /* Return a random double in the range [lo, hi]. */
-  return lo + (double) random() / (double) RAND_MAX * (hi - lo);
+  return lo + (double) rnd() / (double) RAND_MAX * (hi - lo);
 }
 
 void shuffle(int N, int* ord) {
   for (int i = 0; i < N - 1; i++) {
-    int j = (int) (i + random() / (RAND_MAX / (N - i) + 1));
+    int j = (int) (i + rnd() / (RAND_MAX / (N - i) + 1));
+    int t = ord[j];
+    ord[j] = ord[i];
+    ord[i] = t;
+  }
+}
+
+void shuffler(int N, int* ord, unsigned int* seed) {
+  /* Reentrant shuffle(), for use by concurrent threads each with its own seed. */
+  for (int i = 0; i < N - 1; i++) {
+    int j = (int) (i + rand_r(seed) / (RAND_MAX / (N - i) + 1));
     int t = ord[j];
     ord[j] = ord[i];
     ord[i] = t;
@@ -98,4 +136,136 @@ ActPair actpair(const char* act) {
   else if (strcmp(act, "stepu") == 0) return (ActPair) {.f = stepu, .df = dstepu};
   fprintf(stderr, "ERROR: unknown activation function\n");
   exit(1);
+}
+
+/* whole-layer activation functions
+ * One call per layer, instead of one indirect call per node, and loops simple enough for the compiler to vectorise.
+ * The logistic functions take exp() from kerexp(), whose relative error is below 3e-13, unless the exact ones, which call the libm exp(), are chosen. */
+
+static void linearv(int /*n*/, double* /*x*/) {
+}
+
+static void dlinearv(int /*n*/, const double* /*o*/, double* /*d*/) {
+}
+
+static void reluv(int n, double* x) {
+  for (int j = 0; j < n; j++) x[j] = x[j] > 0.0 ? x[j] : 0.01;
+}
+
+static void dreluv(int n, const double* o, double* d) {
+  for (int j = 0; j < n; j++) d[j] *= o[j] > 0.0 ? 1.0 : 0.01;
+}
+
+static void logisticbv(int n, double* x) {
+  kerexp(n, -1.0, x, x);
+  for (int j = 0; j < n; j++) x[j] = 2.0 / (1.0 + x[j]) - 1.0;
+}
+
+static void logisticbx(int n, double* x) {
+  for (int j = 0; j < n; j++) x[j] = logisticb(x[j]);
+}
+
+static void dlogisticbv(int n, const double* o, double* d) {
+  for (int j = 0; j < n; j++) d[j] *= 0.5 * (1.0 - o[j] * o[j]);
+}
+
+static void logisticuv(int n, double* x) {
+  kerexp(n, -1.0, x, x);
+  for (int j = 0; j < n; j++) x[j] = 1.0 / (1.0 + x[j]);
+}
+
+static void logisticux(int n, double* x) {
+  for (int j = 0; j < n; j++) x[j] = logisticu(x[j]);
+}
+
+static void dlogisticuv(int n, const double* o, double* d) {
+  for (int j = 0; j < n; j++) d[j] *= o[j] - o[j] * o[j];
+}
+
+static void stepbv(int n, double* x) {
+  for (int j = 0; j < n; j++) x[j] = stepb(x[j]);
+}
+
+static void dstepbv(int n, const double* o, double* d) {
+  for (int j = 0; j < n; j++) d[j] *= dstepb(o[j]);
+}
+
+static void stepuv(int n, double* x) {
+  for (int j = 0; j < n; j++) x[j] = stepu(x[j]);
+}
+
+static void dstepuv(int n, const double* o, double* d) {
+  for (int j = 0; j < n; j++) d[j] *= dstepu(o[j]);
+}
+
+ActPairv actpairv(const char* act, bool exact) {
+  if (strcmp(act, "linear") == 0) return (ActPairv) {.f = linearv, .df = dlinearv};
+  else if (strcmp(act, "relu") == 0) return (ActPairv) {.f = reluv, .df = dreluv};
+  else if (strcmp(act, "logisticb") == 0) return (ActPairv) {.f = exact ? logisticbx : logisticbv, .df = dlogisticbv};
+  else if (strcmp(act, "logisticu") == 0) return (ActPairv) {.f = exact ? logisticux : logisticuv, .df = dlogisticuv};
+  else if (strcmp(act, "stepb") == 0) return (ActPairv) {.f = stepbv, .df = dstepbv};
+  else if (strcmp(act, "stepu") == 0) return (ActPairv) {.f = stepuv, .df = dstepuv};
+  fprintf(stderr, "ERROR: unknown activation function\n");
+  exit(1);
+}
+
+/* single-precision activation functions */
+
+inline float linearf(float x) {
+  return x;
+}
+
+inline float dlinearf(float /*x*/) {
+  return 1.0f;
+}
+
+inline float reluf(float x) {
+  return x > 0.0f ? x : 0.01f;
+}
+
+inline float dreluf(float x) {
+  return x > 0.0f ? 1.0f : 0.01f;
+}
+
+inline float logisticbf(float x) {
+  return 2.0f / (1.0f + expf(-x)) - 1.0f;
+}
+
+inline float dlogisticbf(float x) {
+  return 0.5f * (1.0f - x * x);
+}
+
+inline float logisticuf(float x) {
+  return 1.0f / (1.0f + expf(-x));
+}
+
+inline float dlogisticuf(float x) {
+  return x - x * x;
+}
+
+inline float stepbf(float x) {
+  return x < 0.0f ? -0.99f : (x > 0.0f ? 0.99f : 0.0f);
+}
+
+inline float dstepbf(float x) {
+  return iszero(x) ? 1.99f : 0.01f;
+}
+
+inline float stepuf(float x) {
+  return x < 0.0f ? 0.01f : (x > 0.0f ? 0.99f : 0.0f);
+}
+
+inline float dstepuf(float x) {
+  return iszero(x) ? 0.99f : 0.01f;
+}
+
+ActPairf actpairf(const char* act) {
+  if (strcmp(act, "linear") == 0) return (ActPairf) {.f = linearf, .df = dlinearf};
+  else if (strcmp(act, "relu") == 0) return (ActPairf) {.f = reluf, .df = dreluf};
+  else if (strcmp(act, "logisticb") == 0) return (ActPairf) {.f = logisticbf, .df = dlogisticbf};
+  else if (strcmp(act, "logisticu") == 0) return (ActPairf) {.f = logisticuf, .df = dlogisticuf};
+  else if (strcmp(act, "stepb") == 0) return (ActPairf) {.f = stepbf, .df = dstepbf};
+  else if (strcmp(act, "stepu") == 0) return (ActPairf) {.f = stepuf, .df = dstepuf};
+  fprintf(stderr, "ERROR: unknown activation function\n");
+  exit(1);
 }
\ No newline at end of file
@@ -12,13 +12,29 @@ typedef double (* Act)(double); // activation function
 typedef struct ActPair {
   Act f, df;
 } ActPair;
+typedef void (* Actv)(int n, double* x); // whole-layer activation function; x[j] = f(x[j])
+typedef void (* Dactv)(int n, const double* o, double* d); // whole-layer derivative; d[j] = d[j] * df(o[j])
+typedef struct ActPairv {
+  Actv f;
+  Dactv df;
+} ActPairv;
+typedef bool (* Watch)(void* watcher, int c, int C, double e); // called after training cycle c of C with its error e; returns false to stop the training
+typedef float (* Actf)(float); // single-precision activation function
+typedef struct ActPairf {
+  Actf f, df;
+} ActPairf;
 
 extern bool istrue(const char* s);
 extern bool iszero(double x);
 extern double sqre(double x);
 extern double sumsqre(double a, double c);
+extern double now(void);
+extern void rngseed(unsigned int seed);
+extern unsigned int rngstate(void);
+extern long rnd(void);
 extern double randin(double lo, double hi);
 extern void shuffle(int N, int* ord);
+extern void shuffler(int N, int* ord, unsigned int* seed);
 extern double linear(double x);
 extern double dlinear(double);
 extern double relu(double x);
@@ -32,5 +48,19 @@ extern double dstepb(double x);
 extern double stepu(double x);
 extern double dstepu(double x);
 extern ActPair actpair(const char* act);
+extern ActPairv actpairv(const char* act, bool exact);
+extern float linearf(float x);
+extern float dlinearf(float);
+extern float reluf(float x);
+extern float dreluf(float x);
+extern float logisticbf(float x);
+extern float dlogisticbf(float x);
+extern float logisticuf(float x);
+extern float dlogisticuf(float x);
+extern float stepbf(float x);
+extern float dstepbf(float x);
+extern float stepuf(float x);
+extern float dstepuf(float x);
+extern ActPairf actpairf(const char* act);
 
 #endif // NN_ETC_H
@@ -0,0 +1,217 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * References:
+ * KDT: An Algorithm for Finding Best Matches in Logarithmic Expected Time, Friedman (1977)
+ * k-d tree over a snapshot of points that go on moving, like the code vectors of a learning map.
+ * A search scores the points where they are now, and widens each tree node's bounding box by its slack, the farthest any of its points has drifted
+ * from its snapshot, so it still finds the nearest point; the caller rebuilds the tree once the slack grows large against the leaves. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "etc.h"
+#include "ker.h"
+#include "kdt.h"
+
+#define LEAF 8 // largest number of points in a leaf
+
+static inline double coord(const Kdt* kd, int r, int i) {
+  /* Return snapshot point r's coordinate in dimension i. */
+  return kd->p[(size_t) r * kd->S + i];
+}
+
+static void rank(Kdt* kd, int lo, int hi, int m, int d) {
+  /* Arrange ix[lo .. hi) so that ix[m] holds the point of rank m - lo in dimension d, with none above it before it, and none below it after it. */
+  int* ix = kd->ix;
+  while (hi - lo > 1) {
+    const double v = coord(kd, ix[(lo + hi) / 2], d);
+    int i = lo, j = hi - 1;
+    while (i <= j) {
+      while (coord(kd, ix[i], d) < v) i++;
+      while (coord(kd, ix[j], d) > v) j--;
+      if (i <= j) {
+        const int t = ix[i];
+        ix[i++] = ix[j];
+        ix[j--] = t;
+      }
+    }
+    if (m <= j) hi = j + 1;
+    else if (m >= i) lo = i;
+    else return; // ix[j + 1 .. i) all equal v
+  }
+}
+
+static void split(Kdt* kd, int k, int lo, int hi) {
+  /* Make tree node k of the points ix[lo .. hi), and split it at the median of its widest dimension, until the leaves are small. */
+  const int I = kd->I;
+  double* bl = kd->box + (size_t) 2 * I * k;
+  double* bh = bl + I;
+  for (int i = 0; i < I; i++) bl[i] = bh[i] = coord(kd, kd->ix[lo], i);
+  for (int q = lo + 1; q < hi; q++)
+    for (int i = 0; i < I; i++) {
+      const double v = coord(kd, kd->ix[q], i);
+      if (v < bl[i]) bl[i] = v;
+      if (v > bh[i]) bh[i] = v;
+    }
+  kd->lo[k] = lo;
+  kd->hi[k] = hi;
+  kd->sl[k] = 0.0;
+  if (hi - lo <= LEAF) {
+    kd->kid[k] = -1;
+    for (int q = lo; q < hi; q++) kd->leaf[kd->ix[q]] = k;
+    double h = 0.0;
+    for (int i = 0; i < I; i++) h += sqre(bh[i] - bl[i]);
+    kd->spread += sqrt(h) / 2.0; // summed here, averaged in kdtbuild()
+    return;
+  }
+  int d = 0;
+  for (int i = 1; i < I; i++)
+    if (bh[i] - bl[i] > bh[d] - bl[d]) d = i;
+  const int m = (lo + hi) / 2;
+  rank(kd, lo, hi, m, d);
+  kd->dim[k] = d;
+  kd->cut[k] = coord(kd, kd->ix[m], d); // ix[lo .. m) lie at or below it, ix[m .. hi) at or above it
+  const int c = kd->N;
+  kd->N += 2;
+  kd->kid[k] = c;
+  kd->up[c] = kd->up[c + 1] = k;
+  split(kd, c, lo, m);
+  split(kd, c + 1, m, hi);
+}
+
+Kdt* kdtnew(int R, int I, int S) {
+  /* Create an empty tree over R points of I dimensions, whose rows are S apart. */
+  Kdt* kd = malloc(sizeof(Kdt));
+  kd->R = R;
+  kd->I = I;
+  kd->S = S;
+  kd->p = malloc((size_t) R * S * sizeof(double));
+  kd->ix = malloc(R * sizeof(int));
+  const int N = 2 * R; // a binary tree of R non-empty leaves at most has 2R - 1 nodes
+  kd->N = 0;
+  kd->lo = malloc(N * sizeof(int));
+  kd->hi = malloc(N * sizeof(int));
+  kd->kid = malloc(N * sizeof(int));
+  kd->dim = malloc(N * sizeof(int));
+  kd->cut = malloc(N * sizeof(double));
+  kd->up = malloc(N * sizeof(int));
+  kd->leaf = malloc(R * sizeof(int));
+  kd->sl = malloc(N * sizeof(double));
+  kd->box = malloc((size_t) N * 2 * I * sizeof(double));
+  kd->spread = 0.0;
+  return kd;
+}
+
+void kdtdel(Kdt* kd) {
+  /* Destroy the tree. */
+  free(kd->box);
+  kd->box = NULL;
+  free(kd->sl);
+  kd->sl = NULL;
+  free(kd->leaf);
+  kd->leaf = NULL;
+  free(kd->up);
+  kd->up = NULL;
+  free(kd->cut);
+  kd->cut = NULL;
+  free(kd->dim);
+  kd->dim = NULL;
+  free(kd->kid);
+  kd->kid = NULL;
+  free(kd->hi);
+  kd->hi = NULL;
+  free(kd->lo);
+  kd->lo = NULL;
+  free(kd->ix);
+  kd->ix = NULL;
+  free(kd->p);
+  kd->p = NULL;
+  free(kd);
+}
+
+void kdtbuild(Kdt* kd, const double* P) {
+  /* Snapshot the points (P), and rebuild the tree over them. */
+  memcpy(kd->p, P, (size_t) kd->R * kd->S * sizeof(double));
+  for (int r = 0; r < kd->R; r++) kd->ix[r] = r;
+  kd->N = 1;
+  kd->up[0] = -1;
+  kd->spread = 0.0;
+  split(kd, 0, 0, kd->R);
+  const int leaves = (kd->N + 1) / 2;
+  kd->spread /= leaves;
+}
+
+double kdtdist(int I, const double* u, const double* v) {
+  /* d = ||[u] - [v]||^2 */
+  double d = 0.0;
+  for (int i = 0; i < I; i++) d += sqre(u[i] - v[i]);
+  return d;
+}
+
+void kdtmove(Kdt* kd, int r, double d) {
+  /* Note that point r now lies at the squared distance d from its snapshot, and raise the slack of the tree nodes above it to match. */
+  for (int k = kd->leaf[r]; k >= 0 && kd->sl[k] < d; k = kd->up[k]) kd->sl[k] = d;
+}
+
+typedef struct Query {
+  const double* P; // the points as they are now
+  const double* q; // their squared norms
+  const double* x; // query point, padded to S
+  double xx; // its squared norm
+  double g; // relative rounding error of a score
+  int best; // the point of least score so far
+  double bs; // its score
+  long n; // number of points scored
+} Query;
+
+static void near(const Kdt* kd, int k, Query* qy) {
+  /* Search tree node k, unless every point in it, widened by its slack, is farther than the best so far.
+   * The points are ranked by their scores, but the tree prunes by distance, of which a score plus ||[x]||^2 is an estimate; a node is pruned only
+   * when it lies farther than that estimate by more than the rounding error of the scores of points that near, so that no point of a lower score
+   * is missed. */
+  const int I = kd->I;
+  const double* bl = kd->box + (size_t) 2 * I * k;
+  const double* bh = bl + I;
+  const double* x = qy->x;
+  double b = 0.0; // squared distance from x to the snapshot box
+  for (int i = 0; i < I; i++)
+    if (x[i] < bl[i]) b += sqre(bl[i] - x[i]);
+    else if (x[i] > bh[i]) b += sqre(x[i] - bh[i]);
+  const double lb = sqrt(b) - sqrt(kd->sl[k]); // lower bound of the distance from x to the points as they are now
+  if (lb > 0.0 && qy->best >= 0) {
+    const double bd = fmax(qy->bs + qy->xx, 0.0); // estimated squared distance of the best so far
+    if (sqre(lb) > bd + qy->g * sqre(2.0 * sqrt(qy->xx) + sqrt(bd) + lb)) return;
+  }
+  if (kd->kid[k] < 0) {
+    for (int u = kd->lo[k]; u < kd->hi[k]; u++) {
+      const int r = kd->ix[u];
+      double s;
+      kernear(1, kd->S, qy->P + (size_t) r * kd->S, x, -2.0, qy->q + r, &s); // scored as in a full scan of the points
+      if (s < qy->bs || (s == qy->bs && r < qy->best)) { // the lower index wins a tie
+        qy->best = r;
+        qy->bs = s;
+      }
+    }
+    qy->n += kd->hi[k] - kd->lo[k];
+    return;
+  }
+  const int c = kd->kid[k];
+  const int f = x[kd->dim[k]] <= kd->cut[k] ? c : c + 1; // nearer child first, so that the best so far tightens early
+  near(kd, f, qy);
+  near(kd, f == c ? c + 1 : c, qy);
+}
+
+long kdtnear(const Kdt* kd, const double* P, const double* q, const double* x, int* k, double* s) {
+  /* Find the point r of (P) of least score q[r] - 2 [P]_r . [x], given that kdtmove() has noted how far each point has drifted, and return the
+   * number of points scored. The score ranks the points as their squared distances from [x] do, and kernear() ranks them by it, so both searches
+   * agree on the nearest point, and on a tie, the lower index wins.
+   * q: squared norms of the points
+   * x: the query point, padded to S with zeros
+   * k, s: the best point found so far, and its score; -1 and DBL_MAX for none; replaced by the nearest point and its score */
+  Query qy = {.P = P, .q = q, .x = x, .xx = kerdot(kd->S, x, x), .g = 4.0 * (kd->S + 2) * DBL_EPSILON, .best = *k, .bs = *s, .n = 0};
+  near(kd, 0, &qy);
+  *k = qy.best;
+  *s = qy.bs;
+  return qy.n;
+}
@@ -0,0 +1,32 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_KDT_H
+#define NN_KDT_H
+
+typedef struct Kdt { // k-d tree over a snapshot of R points, for nearest-neighbour searches among the points as they drift after the snapshot
+  int R; // number of points
+  int I; // number of dimensions
+  int S; // row stride of the points; see kerpad()
+  double* p; // snapshot (R x S) of the points, as they were at the last kdtbuild()
+  int* ix; // point indices, arranged so that each tree node's points are contiguous
+  int N; // number of tree nodes; node 0 is the root; 0 until the first kdtbuild()
+  int* lo, * hi; // tree node k holds the points ix[lo[k]] .. ix[hi[k] - 1]
+  int* kid; // tree node k's children are kid[k] and kid[k] + 1; -1 for a leaf
+  int* dim; // dimension along which tree node k is split
+  double* cut; // coordinate at which tree node k is split; the first child's points lie at or below it
+  int* up; // parent of tree node k; -1 for the root
+  int* leaf; // leaf that holds point r
+  double* sl; // slack of tree node k: the largest squared drift of its points from their snapshots; see kdtmove()
+  double* box; // bounding box of tree node k's points: box[2 I k + i] and box[2 I k + I + i] are its low and high bounds in dimension i
+  double spread; // mean half-diagonal of the leaves' bounding boxes
+} Kdt;
+
+extern Kdt* kdtnew(int R, int I, int S);
+extern void kdtdel(Kdt* kd);
+extern void kdtbuild(Kdt* kd, const double* P);
+extern void kdtmove(Kdt* kd, int r, double d);
+extern long kdtnear(const Kdt* kd, const double* P, const double* q, const double* x, int* k, double* s);
+extern double kdtdist(int I, const double* u, const double* v);
+
+#endif // NN_KDT_H
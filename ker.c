@@ -0,0 +1,624 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Vector kernels for the inner loops of the networks.
+ * Each kernel has a portable scalar version and, on x86, SSE2 and AVX2 versions.
+ * The fastest version the CPU supports is selected once, at start up. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include "ker.h"
+
+#define MB 16 // rows of (A) per block; keeps a block of (A) in L1
+#define NB 64 // rows of (B) per block in kergemmnt(); keeps a block of (B) in L2
+#define KB 256 // inner dimension per block
+#define CB 256 // columns of (B) and (C) per block in kergemmnn() and kergemmtn()
+#define XMAX 708.0 // largest magnitude of an exponent whose power is a normal double
+#define LOG2E 1.4426950408889634 // 1 / ln 2
+#define LN2HI 6.93145751953125e-1 // ln 2 split in two, so that k * LN2HI is exact for |k| < 2^11; see Cody and Waite (1980)
+#define LN2LO 1.4286068203094172321e-6
+#define XD 10 // degree of the exp() polynomial
+
+static const double xc[XD + 1] = { // Taylor coefficients 1 / d! of exp(r)
+    1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320, 1.0 / 362880, 1.0 / 3628800,
+};
+
+static inline int min(int a, int b) {
+  return a < b ? a : b;
+}
+
+inline int kerpad(int n) {
+  /* Round n up to a whole number of cache lines of doubles. */
+  const int D = ALIGN / (int) sizeof(double);
+  return (n + D - 1) / D * D;
+}
+
+double* keralloc(int n) {
+  /* Allocate a zeroed, cache-line-aligned, padded array of n doubles. */
+  const size_t z = kerpad(n > 0 ? n : 1) * sizeof(double);
+  double* a = aligned_alloc(ALIGN, z);
+  memset(a, 0, z);
+  return a;
+}
+
+inline int kerpadf(int n) {
+  /* Round n up to a whole number of cache lines of floats. */
+  const int F = ALIGN / (int) sizeof(float);
+  return (n + F - 1) / F * F;
+}
+
+float* kerallocf(int n) {
+  /* Allocate a zeroed, cache-line-aligned, padded array of n floats. */
+  const size_t z = kerpadf(n > 0 ? n : 1) * sizeof(float);
+  float* a = aligned_alloc(ALIGN, z);
+  memset(a, 0, z);
+  return a;
+}
+
+inline int kerpadq(int n) {
+  /* Round n up to a whole number of cache lines of 8-bit integers. */
+  return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+int8_t* kerallocq(int n) {
+  /* Allocate a zeroed, cache-line-aligned, padded array of n 8-bit integers. */
+  const size_t z = kerpadq(n > 0 ? n : 1);
+  int8_t* a = aligned_alloc(ALIGN, z);
+  memset(a, 0, z);
+  return a;
+}
+
+/* scalar */
+
+static double dot(int n, const double* x, const double* y) {
+  /* d = [x] . [y] */
+  double d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0; // independent partial sums hide the add latency
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    d0 += x[i] * y[i];
+    d1 += x[i + 1] * y[i + 1];
+    d2 += x[i + 2] * y[i + 2];
+    d3 += x[i + 3] * y[i + 3];
+  }
+  for (; i < n; i++) d0 += x[i] * y[i];
+  return (d0 + d1) + (d2 + d3);
+}
+
+static double doti(int n, const double* x, const int* c, const double* y) {
+  /* d = [x] . [y], where x holds the n non-zeros of a sparse vector, at the indices c of y */
+  double d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    d0 += x[i] * y[c[i]];
+    d1 += x[i + 1] * y[c[i + 1]];
+    d2 += x[i + 2] * y[c[i + 2]];
+    d3 += x[i + 3] * y[c[i + 3]];
+  }
+  for (; i < n; i++) d0 += x[i] * y[c[i]];
+  return (d0 + d1) + (d2 + d3);
+}
+
+static int near(int R, int n, const double* M, const double* x, double s, const double* q, double* d) {
+  /* Return the row r of the (R x n) matrix (M) that minimises q[r] + s * (M)[r] . [x], the first one on a tie, and leave the minimum in d; q NULL counts as zeros. */
+  int k = -1;
+  double min = DBL_MAX;
+  for (int r = 0; r < R; r++) {
+    const double v = (q == NULL ? 0.0 : q[r]) + s * dot(n, M + (size_t) r * n, x);
+    if (v < min) {
+      k = r;
+      min = v;
+    }
+  }
+  *d = min;
+  return k;
+}
+
+static void axpy(int n, double a, const double* x, double* y) {
+  /* [y] = a * [x] + [y] */
+  for (int i = 0; i < n; i++) y[i] += a * x[i];
+}
+
+static void step(int n, double a, const double* x, double* y, double* d) {
+  /* [d] = a * ([x] - [y]); [y] = [y] + [d] */
+  for (int i = 0; i < n; i++) {
+    d[i] = a * (x[i] - y[i]);
+    y[i] += d[i];
+  }
+}
+
+static void axpby(int n, double a, const double* x, double b, double* y) {
+  /* [y] = a * [x] + b * [y] */
+  for (int i = 0; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+static float dotf(int n, const float* x, const float* y) {
+  /* d = [x] . [y] */
+  float d0 = 0.0f, d1 = 0.0f, d2 = 0.0f, d3 = 0.0f;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    d0 += x[i] * y[i];
+    d1 += x[i + 1] * y[i + 1];
+    d2 += x[i + 2] * y[i + 2];
+    d3 += x[i + 3] * y[i + 3];
+  }
+  for (; i < n; i++) d0 += x[i] * y[i];
+  return (d0 + d1) + (d2 + d3);
+}
+
+static void axpyf(int n, float a, const float* x, float* y) {
+  /* [y] = a * [x] + [y] */
+  for (int i = 0; i < n; i++) y[i] += a * x[i];
+}
+
+static void axpbyf(int n, float a, const float* x, float b, float* y) {
+  /* [y] = a * [x] + b * [y] */
+  for (int i = 0; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+static inline double expo(double x) {
+  /* exp(x) = 2^k * exp(r), where k = round(x / ln 2) and |r| <= ln 2 / 2, and exp(r) is a polynomial of degree XD.
+   * The truncated series is below 3e-13 of exp(r), so the relative error is below 3e-13 over [-XMAX, +XMAX]; x is clamped to that range. */
+  x = x < -XMAX ? -XMAX : x > XMAX ? XMAX : x;
+  const double k = (double) (long) (x * LOG2E + (x < 0.0 ? -0.5 : 0.5));
+  const double r = x - k * LN2HI - k * LN2LO;
+  double p = xc[XD];
+  for (int d = XD - 1; d >= 0; d--) p = p * r + xc[d];
+  const uint64_t b = (uint64_t) ((long) k + 1023) << 52; // biased exponent of 2^k
+  double s;
+  memcpy(&s, &b, sizeof(s));
+  return p * s;
+}
+
+static void expn(int n, double a, const double* x, double* y) {
+  /* [y] = exp(a * [x]) */
+  for (int i = 0; i < n; i++) y[i] = expo(a * x[i]);
+}
+
+static int32_t dotq(int n, const int8_t* x, const int8_t* y) {
+  /* d = [x] . [y], accumulated in 32 bits; exact for n < 2^17 */
+  int32_t d = 0;
+  for (int i = 0; i < n; i++) d += (int32_t) x[i] * y[i];
+  return d;
+}
+
+const char* kerisa = "scalar";
+double (* kerdot)(int n, const double* x, const double* y) = dot;
+double (* kerdoti)(int n, const double* x, const int* c, const double* y) = doti;
+int (* kernear)(int R, int n, const double* M, const double* x, double s, const double* q, double* d) = near;
+void (* keraxpy)(int n, double a, const double* x, double* y) = axpy;
+void (* keraxpby)(int n, double a, const double* x, double b, double* y) = axpby;
+void (* kerstep)(int n, double a, const double* x, double* y, double* d) = step;
+float (* kerdotf)(int n, const float* x, const float* y) = dotf;
+void (* keraxpyf)(int n, float a, const float* x, float* y) = axpyf;
+void (* keraxpbyf)(int n, float a, const float* x, float b, float* y) = axpbyf;
+void (* kerexp)(int n, double a, const double* x, double* y) = expn;
+int32_t (* kerdotq)(int n, const int8_t* x, const int8_t* y) = dotq;
+
+/* matrix-matrix products; all matrices are row major with leading dimensions (row strides) ld? */
+
+static void scale(int M, int N, double b, double* C, int ldc) {
+  /* (C) = b * (C) */
+  for (int m = 0; m < M; m++)
+    for (int n = 0; n < N; n++) C[m * ldc + n] = b == 0.0 ? 0.0 : b * C[m * ldc + n];
+}
+
+void kergemmnt(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc) {
+  /* (C) = a * (A) * (B)' + b * (C), where (A) is M x K, (B) is N x K, and (C) is M x N.
+   * Every element is a dot product of two contiguous rows; the blocking keeps the rows of (B) in cache while they are reused by MB rows of (A). */
+  for (int n0 = 0; n0 < N; n0 += NB) {
+    const int n1 = min(n0 + NB, N);
+    for (int m0 = 0; m0 < M; m0 += MB) {
+      const int m1 = min(m0 + MB, M);
+      scale(m1 - m0, n1 - n0, b, C + m0 * ldc + n0, ldc);
+      for (int k0 = 0; k0 < K; k0 += KB) {
+        const int k = min(KB, K - k0);
+        for (int m = m0; m < m1; m++)
+          for (int n = n0; n < n1; n++) C[m * ldc + n] += a * kerdot(k, A + m * lda + k0, B + n * ldb + k0);
+      }
+    }
+  }
+}
+
+static void gemm(int M, int N, int K, double a, const double* A, int ra, int ca, const double* B, int ldb, double b, double* C, int ldc) {
+  /* (C) = a * (A) * (B) + b * (C), where A(m, k) = A[m * ra + k * ca].
+   * Each row of (C) accumulates scaled rows of (B); the blocking keeps a CB-wide strip of KB rows of (B) in cache. */
+  for (int n0 = 0; n0 < N; n0 += CB) {
+    const int n = min(CB, N - n0);
+    for (int m0 = 0; m0 < M; m0 += MB) {
+      const int m1 = min(m0 + MB, M);
+      scale(m1 - m0, n, b, C + m0 * ldc + n0, ldc);
+      for (int k0 = 0; k0 < K; k0 += KB) {
+        const int k1 = min(k0 + KB, K);
+        for (int m = m0; m < m1; m++)
+          for (int k = k0; k < k1; k++) keraxpy(n, a * A[m * ra + k * ca], B + k * ldb + n0, C + m * ldc + n0);
+      }
+    }
+  }
+}
+
+void kergemmnn(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc) {
+  /* (C) = a * (A) * (B) + b * (C), where (A) is M x K, (B) is K x N, and (C) is M x N. */
+  gemm(M, N, K, a, A, lda, 1, B, ldb, b, C, ldc);
+}
+
+void kergemmtn(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc) {
+  /* (C) = a * (A)' * (B) + b * (C), where (A) is K x M, (B) is K x N, and (C) is M x N. */
+  gemm(M, N, K, a, A, 1, lda, B, ldb, b, C, ldc);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/* SSE2 */
+
+__attribute__((target("sse2"))) static double dotsse2(int n, const double* x, const double* y) {
+  __m128d d0 = _mm_setzero_pd(), d1 = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    d0 = _mm_add_pd(d0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    d1 = _mm_add_pd(d1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+  }
+  d0 = _mm_add_pd(d0, d1);
+  double d = _mm_cvtsd_f64(_mm_add_sd(d0, _mm_unpackhi_pd(d0, d0)));
+  for (; i < n; i++) d += x[i] * y[i];
+  return d;
+}
+
+__attribute__((target("sse2"))) static double dotisse2(int n, const double* x, const int* c, const double* y) {
+  __m128d d0 = _mm_setzero_pd(), d1 = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) { // SSE2 has no gather; the pairs are loaded one element at a time
+    d0 = _mm_add_pd(d0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_set_pd(y[c[i + 1]], y[c[i]])));
+    d1 = _mm_add_pd(d1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_set_pd(y[c[i + 3]], y[c[i + 2]])));
+  }
+  d0 = _mm_add_pd(d0, d1);
+  double d = _mm_cvtsd_f64(_mm_add_sd(d0, _mm_unpackhi_pd(d0, d0)));
+  for (; i < n; i++) d += x[i] * y[c[i]];
+  return d;
+}
+
+__attribute__((target("sse2"))) static int nearsse2(int R, int n, const double* M, const double* x, double s, const double* q, double* dm) {
+  /* Two rows at a time; n is a multiple of 4, as kerpad() makes it. */
+  const __m128d sv = _mm_set1_pd(s), two = _mm_set1_pd(2.0);
+  __m128d min = _mm_set1_pd(DBL_MAX), k = _mm_set1_pd(-1.0), r2 = _mm_setr_pd(0.0, 1.0);
+  int r = 0;
+  for (; r + 2 <= R; r += 2) {
+    const double* m = M + (size_t) r * n;
+    __m128d d0 = _mm_setzero_pd(), d1 = _mm_setzero_pd();
+    for (int i = 0; i < n; i += 2) {
+      const __m128d xv = _mm_loadu_pd(x + i);
+      d0 = _mm_add_pd(d0, _mm_mul_pd(_mm_loadu_pd(m + i), xv));
+      d1 = _mm_add_pd(d1, _mm_mul_pd(_mm_loadu_pd(m + n + i), xv));
+    }
+    // transpose-add the two partial sums into the two rows' dot products
+    const __m128d d = _mm_add_pd(_mm_unpacklo_pd(d0, d1), _mm_unpackhi_pd(d0, d1));
+    const __m128d v = q == NULL ? _mm_mul_pd(sv, d) : _mm_add_pd(_mm_loadu_pd(q + r), _mm_mul_pd(sv, d));
+    const __m128d lt = _mm_cmplt_pd(v, min);
+    min = _mm_or_pd(_mm_and_pd(lt, v), _mm_andnot_pd(lt, min));
+    k = _mm_or_pd(_mm_and_pd(lt, r2), _mm_andnot_pd(lt, k));
+    r2 = _mm_add_pd(r2, two);
+  }
+  // reduce the lanes, the lower row on a tie, then finish the row left over
+  double mv[2], kv[2];
+  _mm_storeu_pd(mv, min);
+  _mm_storeu_pd(kv, k);
+  int best = -1;
+  double b = DBL_MAX;
+  for (int l = 0; l < 2; l++)
+    if (kv[l] >= 0.0 && (mv[l] < b || (mv[l] == b && (int) kv[l] < best))) {
+      best = (int) kv[l];
+      b = mv[l];
+    }
+  for (; r < R; r++) { // summed in the same order as in the two-row step, so a row's distance does not depend on its position
+    __m128d dr = _mm_setzero_pd();
+    for (int i = 0; i < n; i += 2) dr = _mm_add_pd(dr, _mm_mul_pd(_mm_loadu_pd(M + (size_t) r * n + i), _mm_loadu_pd(x + i)));
+    const __m128d dv = _mm_add_sd(dr, _mm_unpackhi_pd(dr, dr));
+    const double d = _mm_cvtsd_f64(q == NULL ? _mm_mul_sd(_mm_set_sd(s), dv) : _mm_add_sd(_mm_set_sd(q[r]), _mm_mul_sd(_mm_set_sd(s), dv)));
+    if (d < b) {
+      best = r;
+      b = d;
+    }
+  }
+  *dm = b;
+  return best;
+}
+
+__attribute__((target("sse2"))) static void axpysse2(int n, double a, const double* x, double* y) {
+  const __m128d va = _mm_set1_pd(a);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+  for (; i < n; i++) y[i] += a * x[i];
+}
+
+__attribute__((target("sse2"))) static void stepsse2(int n, double a, const double* x, double* y, double* d) {
+  const __m128d av = _mm_set1_pd(a);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const __m128d yv = _mm_loadu_pd(y + i);
+    const __m128d dv = _mm_mul_pd(av, _mm_sub_pd(_mm_loadu_pd(x + i), yv));
+    _mm_storeu_pd(d + i, dv);
+    _mm_storeu_pd(y + i, _mm_add_pd(yv, dv));
+  }
+  for (; i < n; i++) {
+    d[i] = a * (x[i] - y[i]);
+    y[i] += d[i];
+  }
+}
+
+__attribute__((target("sse2"))) static void axpbysse2(int n, double a, const double* x, double b, double* y) {
+  const __m128d va = _mm_set1_pd(a), vb = _mm_set1_pd(b);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(y + i, _mm_add_pd(_mm_mul_pd(va, _mm_loadu_pd(x + i)), _mm_mul_pd(vb, _mm_loadu_pd(y + i))));
+  for (; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+__attribute__((target("sse2"))) static float dotfsse2(int n, const float* x, const float* y) {
+  __m128 d0 = _mm_setzero_ps(), d1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+  }
+  d0 = _mm_add_ps(d0, d1);
+  d0 = _mm_add_ps(d0, _mm_movehl_ps(d0, d0));
+  float d = _mm_cvtss_f32(_mm_add_ss(d0, _mm_shuffle_ps(d0, d0, 1)));
+  for (; i < n; i++) d += x[i] * y[i];
+  return d;
+}
+
+__attribute__((target("sse2"))) static void axpyfsse2(int n, float a, const float* x, float* y) {
+  const __m128 va = _mm_set1_ps(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  for (; i < n; i++) y[i] += a * x[i];
+}
+
+__attribute__((target("sse2"))) static void axpbyfsse2(int n, float a, const float* x, float b, float* y) {
+  const __m128 va = _mm_set1_ps(a), vb = _mm_set1_ps(b);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)), _mm_mul_ps(vb, _mm_loadu_ps(y + i))));
+  for (; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+__attribute__((target("sse2"))) static void expsse2(int n, double a, const double* x, double* y) {
+  const __m128d va = _mm_set1_pd(a), lo = _mm_set1_pd(-XMAX), hi = _mm_set1_pd(XMAX);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const __m128d v = _mm_min_pd(_mm_max_pd(_mm_mul_pd(va, _mm_loadu_pd(x + i)), lo), hi);
+    const __m128i k = _mm_cvtpd_epi32(_mm_mul_pd(v, _mm_set1_pd(LOG2E))); // rounds to nearest
+    const __m128d kd = _mm_cvtepi32_pd(k);
+    const __m128d r = _mm_sub_pd(_mm_sub_pd(v, _mm_mul_pd(kd, _mm_set1_pd(LN2HI))), _mm_mul_pd(kd, _mm_set1_pd(LN2LO)));
+    __m128d p = _mm_set1_pd(xc[XD]);
+    for (int d = XD - 1; d >= 0; d--) p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(xc[d]));
+    const __m128i e = _mm_slli_epi64(_mm_unpacklo_epi32(_mm_add_epi32(k, _mm_set1_epi32(1023)), _mm_setzero_si128()), 52); // 2^k
+    _mm_storeu_pd(y + i, _mm_mul_pd(p, _mm_castsi128_pd(e)));
+  }
+  for (; i < n; i++) y[i] = expo(a * x[i]);
+}
+
+__attribute__((target("sse2"))) static int32_t dotqsse2(int n, const int8_t* x, const int8_t* y) {
+  __m128i d = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i*) (x + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*) (y + i));
+    // sign extend the bytes to 16 bits by placing each in the high half of a word, then shifting it down arithmetically
+    const __m128i alo = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8), ahi = _mm_srai_epi16(_mm_unpackhi_epi8(a, a), 8);
+    const __m128i blo = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8), bhi = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+    d = _mm_add_epi32(d, _mm_add_epi32(_mm_madd_epi16(alo, blo), _mm_madd_epi16(ahi, bhi))); // pairwise products summed into 32 bits
+  }
+  d = _mm_add_epi32(d, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+  d = _mm_add_epi32(d, _mm_shuffle_epi32(d, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t s = _mm_cvtsi128_si32(d);
+  for (; i < n; i++) s += (int32_t) x[i] * y[i];
+  return s;
+}
+
+/* AVX2 */
+
+__attribute__((target("avx2,fma"))) static double dotavx2(int n, const double* x, const double* y) {
+  __m256d d0 = _mm256_setzero_pd(), d1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    d0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), d0);
+    d1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), d1);
+  }
+  for (; i + 4 <= n; i += 4) d0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), d0);
+  d0 = _mm256_add_pd(d0, d1);
+  __m128d h = _mm_add_pd(_mm256_castpd256_pd128(d0), _mm256_extractf128_pd(d0, 1));
+  double d = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+  for (; i < n; i++) d += x[i] * y[i];
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) static double dotiavx2(int n, const double* x, const int* c, const double* y) {
+  __m256d d0 = _mm256_setzero_pd(), d1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    d0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_i32gather_pd(y, _mm_loadu_si128((const __m128i*) (c + i)), 8), d0);
+    d1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_i32gather_pd(y, _mm_loadu_si128((const __m128i*) (c + i + 4)), 8), d1);
+  }
+  for (; i + 4 <= n; i += 4) d0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_i32gather_pd(y, _mm_loadu_si128((const __m128i*) (c + i)), 8), d0);
+  d0 = _mm256_add_pd(d0, d1);
+  __m128d h = _mm_add_pd(_mm256_castpd256_pd128(d0), _mm256_extractf128_pd(d0, 1));
+  double d = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+  for (; i < n; i++) d += x[i] * y[c[i]];
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) static int nearavx2(int R, int n, const double* M, const double* x, double s, const double* q, double* dm) {
+  /* Four rows at a time; n is a multiple of 4, as kerpad() makes it. */
+  const __m256d sv = _mm256_set1_pd(s), four = _mm256_set1_pd(4.0);
+  __m256d min = _mm256_set1_pd(DBL_MAX), k = _mm256_set1_pd(-1.0), r4 = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+  int r = 0;
+  for (; r + 4 <= R; r += 4) {
+    const double* m = M + (size_t) r * n;
+    __m256d d0 = _mm256_setzero_pd(), d1 = _mm256_setzero_pd(), d2 = _mm256_setzero_pd(), d3 = _mm256_setzero_pd();
+    for (int i = 0; i < n; i += 4) {
+      const __m256d xv = _mm256_loadu_pd(x + i);
+      d0 = _mm256_fmadd_pd(_mm256_loadu_pd(m + i), xv, d0);
+      d1 = _mm256_fmadd_pd(_mm256_loadu_pd(m + n + i), xv, d1);
+      d2 = _mm256_fmadd_pd(_mm256_loadu_pd(m + 2 * n + i), xv, d2);
+      d3 = _mm256_fmadd_pd(_mm256_loadu_pd(m + 3 * n + i), xv, d3);
+    }
+    // transpose-add the four partial sums into the four rows' dot products
+    const __m256d h01 = _mm256_hadd_pd(d0, d1), h23 = _mm256_hadd_pd(d2, d3);
+    const __m256d d = _mm256_add_pd(_mm256_permute2f128_pd(h01, h23, 0x20), _mm256_permute2f128_pd(h01, h23, 0x31));
+    const __m256d v = q == NULL ? _mm256_mul_pd(sv, d) : _mm256_fmadd_pd(sv, d, _mm256_loadu_pd(q + r));
+    const __m256d lt = _mm256_cmp_pd(v, min, _CMP_LT_OQ);
+    min = _mm256_blendv_pd(min, v, lt);
+    k = _mm256_blendv_pd(k, r4, lt);
+    r4 = _mm256_add_pd(r4, four);
+  }
+  // reduce the lanes, the lowest row on a tie, then finish the rows left over
+  double mv[4], kv[4];
+  _mm256_storeu_pd(mv, min);
+  _mm256_storeu_pd(kv, k);
+  int best = -1;
+  double b = DBL_MAX;
+  for (int l = 0; l < 4; l++)
+    if (kv[l] >= 0.0 && (mv[l] < b || (mv[l] == b && (int) kv[l] < best))) {
+      best = (int) kv[l];
+      b = mv[l];
+    }
+  for (; r < R; r++) { // summed in the same order as in the four-row step, so a row's distance does not depend on its position
+    __m256d dr = _mm256_setzero_pd();
+    for (int i = 0; i < n; i += 4) dr = _mm256_fmadd_pd(_mm256_loadu_pd(M + (size_t) r * n + i), _mm256_loadu_pd(x + i), dr);
+    const __m128d h = _mm_hadd_pd(_mm256_castpd256_pd128(dr), _mm256_extractf128_pd(dr, 1));
+    const __m128d dv = _mm_add_sd(h, _mm_unpackhi_pd(h, h));
+    const double d = _mm_cvtsd_f64(q == NULL ? _mm_mul_sd(_mm_set_sd(s), dv) : _mm_fmadd_sd(_mm_set_sd(s), dv, _mm_set_sd(q[r])));
+    if (d < b) {
+      best = r;
+      b = d;
+    }
+  }
+  *dm = b;
+  return best;
+}
+
+__attribute__((target("avx2,fma"))) static void axpyavx2(int n, double a, const double* x, double* y) {
+  const __m256d va = _mm256_set1_pd(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+  for (; i < n; i++) y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma"))) static void stepavx2(int n, double a, const double* x, double* y, double* d) {
+  /* No fused multiply-add, so the result matches the scalar version's. */
+  const __m256d av = _mm256_set1_pd(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d yv = _mm256_loadu_pd(y + i);
+    const __m256d dv = _mm256_mul_pd(av, _mm256_sub_pd(_mm256_loadu_pd(x + i), yv));
+    _mm256_storeu_pd(d + i, dv);
+    _mm256_storeu_pd(y + i, _mm256_add_pd(yv, dv));
+  }
+  for (; i < n; i++) {
+    d[i] = a * (x[i] - y[i]);
+    y[i] += d[i];
+  }
+}
+
+__attribute__((target("avx2,fma"))) static void axpbyavx2(int n, double a, const double* x, double b, double* y) {
+  const __m256d va = _mm256_set1_pd(a), vb = _mm256_set1_pd(b);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_mul_pd(vb, _mm256_loadu_pd(y + i))));
+  for (; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+__attribute__((target("avx2,fma"))) static float dotfavx2(int n, const float* x, const float* y) {
+  __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    d0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), d0);
+    d1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), d1);
+  }
+  for (; i + 8 <= n; i += 8) d0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), d0);
+  d0 = _mm256_add_ps(d0, d1);
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(d0), _mm256_extractf128_ps(d0, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  float d = _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+  for (; i < n; i++) d += x[i] * y[i];
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) static void axpyfavx2(int n, float a, const float* x, float* y) {
+  const __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  for (; i < n; i++) y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma"))) static void axpbyfavx2(int n, float a, const float* x, float b, float* y) {
+  const __m256 va = _mm256_set1_ps(a), vb = _mm256_set1_ps(b);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_mul_ps(vb, _mm256_loadu_ps(y + i))));
+  for (; i < n; i++) y[i] = a * x[i] + b * y[i];
+}
+
+__attribute__((target("avx2,fma"))) static void expavx2(int n, double a, const double* x, double* y) {
+  const __m256d va = _mm256_set1_pd(a), lo = _mm256_set1_pd(-XMAX), hi = _mm256_set1_pd(XMAX);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d v = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(va, _mm256_loadu_pd(x + i)), lo), hi);
+    const __m128i k = _mm256_cvtpd_epi32(_mm256_mul_pd(v, _mm256_set1_pd(LOG2E))); // rounds to nearest
+    const __m256d kd = _mm256_cvtepi32_pd(k);
+    const __m256d r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(LN2LO), _mm256_fnmadd_pd(kd, _mm256_set1_pd(LN2HI), v));
+    __m256d p = _mm256_set1_pd(xc[XD]);
+    for (int d = XD - 1; d >= 0; d--) p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(xc[d]));
+    const __m256i e = _mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm_add_epi32(k, _mm_set1_epi32(1023))), 52); // 2^k
+    _mm256_storeu_pd(y + i, _mm256_mul_pd(p, _mm256_castsi256_pd(e)));
+  }
+  for (; i < n; i++) y[i] = expo(a * x[i]);
+}
+
+__attribute__((target("avx2"))) static int32_t dotqavx2(int n, const int8_t* x, const int8_t* y) {
+  __m256i d = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (x + i)));
+    const __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (y + i)));
+    d = _mm256_add_epi32(d, _mm256_madd_epi16(a, b)); // pairwise products summed into 32 bits
+  }
+  __m128i h = _mm_add_epi32(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1));
+  h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+  h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t s = _mm_cvtsi128_si32(h);
+  for (; i < n; i++) s += (int32_t) x[i] * y[i];
+  return s;
+}
+
+__attribute__((constructor)) static void kerinit(void) {
+  /* Select the kernels for the CPU on which the programme runs. */
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kerisa = "avx2";
+    kerdot = dotavx2;
+    kerdoti = dotiavx2;
+    kernear = nearavx2;
+    keraxpy = axpyavx2;
+    keraxpby = axpbyavx2;
+    kerstep = stepavx2;
+    kerdotf = dotfavx2;
+    keraxpyf = axpyfavx2;
+    keraxpbyf = axpbyfavx2;
+    kerexp = expavx2;
+    kerdotq = dotqavx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    kerisa = "sse2";
+    kerdot = dotsse2;
+    kerdoti = dotisse2;
+    kernear = nearsse2;
+    keraxpy = axpysse2;
+    keraxpby = axpbysse2;
+    kerstep = stepsse2;
+    kerdotf = dotfsse2;
+    keraxpyf = axpyfsse2;
+    keraxpbyf = axpbyfsse2;
+    kerexp = expsse2;
+    kerdotq = dotqsse2;
+  }
+}
+
+#endif
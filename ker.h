@@ -0,0 +1,33 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_KER_H
+#define NN_KER_H
+
+#include <stdint.h>
+
+#define ALIGN 64 // cache line size (in bytes); alignment of all kernel buffers
+
+extern const char* kerisa; // name of the instruction set selected at start up
+extern int kerpad(int n);
+extern double* keralloc(int n);
+extern double (* kerdot)(int n, const double* x, const double* y);
+extern double (* kerdoti)(int n, const double* x, const int* c, const double* y);
+extern int (* kernear)(int R, int n, const double* M, const double* x, double s, const double* q, double* d);
+extern void (* keraxpy)(int n, double a, const double* x, double* y);
+extern void (* keraxpby)(int n, double a, const double* x, double b, double* y);
+extern void (* kerstep)(int n, double a, const double* x, double* y, double* d);
+extern int kerpadf(int n);
+extern float* kerallocf(int n);
+extern float (* kerdotf)(int n, const float* x, const float* y);
+extern void (* keraxpyf)(int n, float a, const float* x, float* y);
+extern void (* keraxpbyf)(int n, float a, const float* x, float b, float* y);
+extern void (* kerexp)(int n, double a, const double* x, double* y);
+extern int kerpadq(int n);
+extern int8_t* kerallocq(int n);
+extern int32_t (* kerdotq)(int n, const int8_t* x, const int8_t* y);
+extern void kergemmnt(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc);
+extern void kergemmnn(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc);
+extern void kergemmtn(int M, int N, int K, double a, const double* A, int lda, const double* B, int ldb, double b, double* C, int ldc);
+
+#endif // NN_KER_H
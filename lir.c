@@ -9,8 +9,19 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "csv.h"
 #include "etc.h"
+#include "ker.h"
+#include "thr.h"
+#include "stm.h"
+#include "spm.h"
+#include "ckp.h"
 #include "lir.h"
 
 void dump(const Ebp* ebp) {
@@ -32,9 +43,168 @@ inline void report(const Ebp* ebp, int c) {
   printf("c = %-10d  e = %-10.8f\n", c, ebp->e);
 }
 
+static bool watch(const Ebp* ebp, int c) {
+  /* Report the current training cycle and current training error to the watcher, if any, else to stdout; return false if the watcher stops the training. */
+  if (ebp->watch != NULL) return ebp->watch(ebp->watcher, c, ebp->C, ebp->e);
+  if (ebp->e < ebp->epsilon || c % (ebp->C / 10) == 0) report(ebp, c);
+  return true;
+}
+
 /* back-propagation */
 
-Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int nC, int nP, bool shuffle, int nL, int nI, const int* nN, char** act) {
+static double** rows(int R, int C) {
+  /* Allocate R rows of C doubles as one contiguous, aligned block.
+   * Each row is padded to whole cache lines, so every row starts on a cache line. */
+  const int S = kerpad(C); // row stride
+  double* b = keralloc(R * S);
+  double** a = malloc(R * sizeof(double*));
+  for (int r = 0; r < R; r++) a[r] = b + r * S;
+  return a;
+}
+
+static void unrows(double** a) {
+  /* Free the rows allocated by rows(). */
+  free(a[0]);
+  free(a);
+}
+
+static void transpose(Ebp* ebp, int l) {
+  /* Refresh the transposed copy of layer l's weights, so the backward pass walks memory in order. */
+  if (l == 0) return;
+  const int J = ebp->N[l];
+  const int I = ebp->N[l - 1];
+  for (int j = 0; j < J; j++)
+    for (int i = 0; i < I; i++) ebp->wt[l][i][j] = ebp->w[l][j][i];
+}
+
+static void delweights(Ebp* ebp) {
+  /* Allocate the network's zeroed del-weights. */
+  ebp->dw = malloc(ebp->L * sizeof(double**));
+  for (int l = 0; l < ebp->L; l++) ebp->dw[l] = rows(ebp->N[l], (l == 0 ? ebp->I : ebp->N[l - 1]) + 1);
+}
+
+static void undelweights(Ebp* ebp) {
+  /* Free the del-weights allocated by delweights(). */
+  for (int l = 0; l < ebp->L; l++) unrows(ebp->dw[l]);
+  free(ebp->dw);
+  ebp->dw = NULL;
+}
+
+static void share(Ebp* ebp) {
+  /* Point the workers at the network's sparse weights, so that they too run on the unpruned weights only. */
+  if (ebp->wk == NULL) return;
+  for (int t = 0; t < ebp->T; t++) ebp->wk[t]->sw = ebp->sw;
+}
+
+static void unsparsify(Ebp* ebp) {
+  /* Free the sparse weights built by sparsify(); every layer runs dense again. */
+  if (ebp->sw == NULL) return;
+  for (int l = 0; l < ebp->L; l++)
+    if (ebp->sw[l] != NULL) spmdel(ebp->sw[l]);
+  free(ebp->sw);
+  ebp->sw = NULL;
+  share(ebp);
+}
+
+static void sparsify(Ebp* ebp) {
+  /* Store in CSR the weights of every layer of which at most DENSITY are non-zero; the other layers run on the dense kernels, which are faster at that density.
+   * The sparse weights are a copy, so they are rebuilt whenever the weights change. */
+  unsparsify(ebp);
+  for (int l = 0; l < ebp->L; l++) {
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    long n = 0;
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i <= I; i++) n += ebp->w[l][j][i] != 0.0;
+    if (n > DENSITY * J * (I + 1)) continue;
+    if (ebp->sw == NULL) ebp->sw = calloc(ebp->L, sizeof(Spm*));
+    ebp->sw[l] = spmnew(J, I + 1, ebp->w[l], 0.0);
+  }
+  share(ebp);
+}
+
+static void buffers(Ebp* ebp) {
+  /* Allocate the network's private per-pattern state: the activations and the deltas. */
+  ebp->p = keralloc(ebp->I + 1); // +1 augmentation for bias node; see fn 1, LIR p 9
+  ebp->p[ebp->I] = 1.0;  // bias node output
+  ebp->i = malloc(ebp->L * sizeof(double*));
+  ebp->o = malloc(ebp->L * sizeof(double*));
+  ebp->d = malloc(ebp->L * sizeof(double*));
+  for (int l = 0; l < ebp->L; l++) {
+    const int J = ebp->N[l];
+    ebp->i[l] = l == 0 ? ebp->p : ebp->o[l - 1];  // point to upstream layer's augmented output vector
+    ebp->o[l] = keralloc(J + 1);
+    ebp->o[l][J] = 1.0;  // bias node output
+    ebp->d[l] = keralloc(J);
+  }
+  if (ebp->B > 1) {
+    ebp->ib = malloc(ebp->L * sizeof(double*));
+    ebp->ob = malloc(ebp->L * sizeof(double*));
+    ebp->db = malloc(ebp->L * sizeof(double*));
+    for (int l = 0; l < ebp->L; l++) {
+      const int J = ebp->N[l];
+      const int S = kerpad(J + 1);
+      ebp->ob[l] = keralloc(ebp->B * S);
+      for (int b = 0; b < ebp->B; b++) ebp->ob[l][b * S + J] = 1.0; // bias node output
+      ebp->db[l] = keralloc(ebp->B * kerpad(J));
+      ebp->ib[l] = l == 0 ? keralloc(ebp->B * kerpad(ebp->I + 1)) : ebp->ob[l - 1]; // point to upstream layer's batch output matrix
+    }
+    for (int b = 0; b < ebp->B; b++) ebp->ib[0][b * kerpad(ebp->I + 1) + ebp->I] = 1.0; // bias node output
+  } else ebp->ib = ebp->ob = ebp->db = NULL;
+}
+
+static void unbuffers(Ebp* ebp) {
+  /* Free the state allocated by buffers(). */
+  if (ebp->B > 1) {
+    for (int l = 0; l < ebp->L; l++) {
+      free(ebp->db[l]);
+      free(ebp->ob[l]);
+    }
+    free(ebp->ib[0]);
+    free(ebp->db);
+    ebp->db = NULL;
+    free(ebp->ob);
+    ebp->ob = NULL;
+    free(ebp->ib);
+    ebp->ib = NULL;
+  }
+  for (int l = 0; l < ebp->L; l++) {
+    free(ebp->d[l]);
+    free(ebp->o[l]);
+  }
+  free(ebp->d);
+  ebp->d = NULL;
+  free(ebp->o);
+  ebp->o = NULL;
+  free(ebp->i);
+  ebp->i = NULL;
+  free(ebp->p);
+  ebp->p = NULL;
+}
+
+static Ebp* worker(const Ebp* ebp, bool own) {
+  /* Create a worker network that shares the weights of ebp but has its own buffers().
+   * own: the worker accumulates its own del-weights, instead of those of ebp */
+  Ebp* wk = malloc(sizeof(Ebp));
+  *wk = *ebp;
+  if (wk->mode == HOGWILD) wk->wt = NULL; // the weights change under a Hogwild worker, so it reads the rows of w, not a stale transpose
+  wk->T = 1;
+  wk->pool = NULL;
+  wk->wk = NULL;
+  // the worker shares the network's sparse weights, which sparsify() rebuilds every cycle and repoints the workers at; see share()
+  buffers(wk);
+  if (own) delweights(wk);
+  return wk;
+}
+
+static void unworker(Ebp* wk, const Ebp* ebp) {
+  /* Destroy the worker network, but not the weights it shares with ebp. */
+  if (wk->dw != ebp->dw) undelweights(wk);
+  unbuffers(wk);
+  free(wk);
+}
+
+Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int nC, int nP, bool shuffle, int nB, int nT, Mode mode, bool sparse, bool exact, int nL, int nI, const int* nN, char** act) {
   /* Create a network.
    * name: network name for use in report()
    * eta: learning rate
@@ -43,6 +213,11 @@ Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int nC,
    * nC: number of training cycles
    * nP: number of pattern vectors
    * shuffle: shuffle the presentation order
+   * nB: number of patterns per batch
+   * nT: number of worker threads
+   * mode: weight update mode
+   * sparse: present the input patterns by their non-zero taps
+   * exact: compute the logistic activations with the libm exp()
    * nL: number of processing layers
    * nI: number of input taps
    * nN[]: number of nodes per layer
@@ -58,67 +233,151 @@ Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int nC,
   ebp->shuffle = shuffle;
   ebp->order = malloc(ebp->P * sizeof(int));
   for (int p = 0; p < ebp->P; p++) ebp->order[p] = p;
+  ebp->B = nB < 1 ? 1 : nB;
+  ebp->mode = mode;
+  if (ebp->mode == HOGWILD && ebp->B > 1) { // each worker applies its del-weights after every pattern
+    fprintf(stderr, "ERROR: network %s cannot train in batches of %d patterns in hogwild mode\n", ebp->name, ebp->B);
+    exit(1);
+  }
+  ebp->sparse = sparse;
+  ebp->exact = exact;
+  ebp->nz = NULL;
   ebp->L = nL;
   ebp->I = nI;
   ebp->N = malloc(ebp->L * sizeof(int));
   ebp->f = malloc(ebp->L * sizeof(Act));
   ebp->df = malloc(ebp->L * sizeof(Act));
-  ebp->p = malloc((ebp->I + 1) * sizeof(double)); // +1 augmentation for bias node; see fn 1, LIR p 9
-  ebp->p[ebp->I] = 1.0;  // bias node output
-  ebp->i = malloc(ebp->L * sizeof(double*));
-  ebp->o = malloc(ebp->L * sizeof(double*));
-  ebp->d = malloc(ebp->L * sizeof(double*));
+  ebp->act = malloc(ebp->L * sizeof(char*));
+  ebp->fv = malloc(ebp->L * sizeof(Actv));
+  ebp->dfv = malloc(ebp->L * sizeof(Dactv));
   ebp->w = malloc(ebp->L * sizeof(double**));
-  ebp->dw = malloc(ebp->L * sizeof(double**));
+  ebp->wt = malloc(ebp->L * sizeof(double**));
   for (int l = 0; l < ebp->L; l++) {
     const int J = nN[l];
     const int I = l == 0 ? ebp->I : nN[l - 1];
     ebp->N[l] = J;
+    ebp->act[l] = strndup(act[l], FLDSIZ); // malloc()
     const ActPair p = actpair(act[l]);
     ebp->f[l] = p.f;
     ebp->df[l] = p.df;
-    ebp->i[l] = l == 0 ? ebp->p : ebp->o[l - 1];  // point to upstream layer's augmented output vector
-    ebp->o[l] = malloc((J + 1) * sizeof(double));
-    ebp->o[l][J] = 1.0;  // bias node output
-    ebp->d[l] = malloc(J * sizeof(double));
-    ebp->w[l] = malloc(J * sizeof(double*));
-    ebp->dw[l] = malloc(J * sizeof(double*));
-    for (int j = 0; j < J; j++) {
-      ebp->w[l][j] = malloc((I + 1) * sizeof(double));
-      ebp->dw[l][j] = malloc((I + 1) * sizeof(double));
-      for (int i = 0; i <= I; i++) {
-        ebp->w[l][j][i] = randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
-        ebp->dw[l][j][i] = 0.0;
-      }
+    const ActPairv v = actpairv(act[l], exact); // chosen once per layer
+    ebp->fv[l] = v.f;
+    ebp->dfv[l] = v.df;
+    ebp->w[l] = rows(J, I + 1);
+    ebp->wt[l] = l == 0 ? NULL : rows(I, J);
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i <= I; i++) ebp->w[l][j][i] = randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
+    transpose(ebp, l);
+  }
+  ebp->map = NULL;
+  ebp->mapsize = 0;
+  ebp->opt = MOMENTUM;
+  ebp->sched = CONSTANT;
+  ebp->lr = ebp->rate = eta;
+  ebp->decay = 1.0;
+  ebp->period = ebp->C;
+  ebp->best = DBL_MAX;
+  ebp->stall = 0;
+  ebp->k = 0;
+  ebp->m = ebp->v = NULL;
+  ebp->prune = 0.0;
+  ebp->sw = NULL;
+  ebp->watch = NULL;
+  ebp->watcher = NULL;
+  ebp->ckp = NULL;
+  ebp->c0 = 0;
+  delweights(ebp);
+  buffers(ebp);
+  // split each cycle's patterns among worker threads
+  ebp->T = nT < 1 ? 1 : nT;
+  ebp->pool = NULL;
+  ebp->wk = NULL;
+  if (ebp->T > 1 || ebp->mode != SYNC) {
+    ebp->pool = poolnew(ebp->T);
+    if (ebp->mode != PIPELINE) { // pipeline stages carry patterns in slot networks instead; see pipenew()
+      ebp->wk = malloc(ebp->T * sizeof(Ebp*));
+      for (int t = 0; t < ebp->T; t++) ebp->wk[t] = worker(ebp, true);
     }
   }
   return ebp;
 }
 
+#define LMMAX 1000 // most weights that Levenberg-Marquardt trains; L-BFGS trains larger networks
+
+static int weights(const Ebp* ebp) {
+  /* Number of weights, including the bias weights. */
+  int n = 0;
+  for (int l = 0; l < ebp->L; l++) n += ebp->N[l] * ((l == 0 ? ebp->I : ebp->N[l - 1]) + 1);
+  return n;
+}
+
+void ebpopt(Ebp* ebp, Optimizer opt, Schedule sched, double decay, int period) {
+  /* Select the network's weight update rule and learning rate schedule; by default, ebpnew() selects MOMENTUM with a CONSTANT rate.
+   * The adaptive optimizers need the cycle's whole gradient, which the momentum rule accumulates in dw when eta and alpha are both 1.0.
+   * decay: learning rate decay factor (STEP, PLATEAU)
+   * period: number of cycles per decay (STEP), or without improvement before a decay (PLATEAU) */
+  if (ebp->mode == HOGWILD && (opt != MOMENTUM || sched != CONSTANT)) {
+    fprintf(stderr, "ERROR: network %s cannot use an adaptive optimizer or a learning rate schedule in hogwild mode\n", ebp->name);
+    exit(1);
+  }
+  if (opt == LM && weights(ebp) > LMMAX) opt = LBFGS; // the Jacobian's normal matrix grows with the square of the weights, its factorization with the cube
+  ebp->opt = opt;
+  ebp->sched = sched;
+  ebp->decay = decay;
+  ebp->period = period < 1 ? 1 : period;
+  if (opt == MOMENTUM || opt == LM || opt == LBFGS) return;
+  ebp->eta = ebp->alpha = 1.0; // (dw) = (d)' * (i) + (dw), summed from zero over the cycle
+  if (ebp->wk != NULL)
+    for (int t = 0; t < ebp->T; t++) ebp->wk[t]->eta = ebp->wk[t]->alpha = 1.0;
+  ebp->m = malloc(ebp->L * sizeof(double**));
+  ebp->v = malloc(ebp->L * sizeof(double**));
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    ebp->m[l] = rows(ebp->N[l], I + 1); // zeroed
+    ebp->v[l] = rows(ebp->N[l], I + 1);
+    if (opt == RPROP)
+      for (int k = 0; k < ebp->N[l] * kerpad(I + 1); k++) ebp->v[l][0][k] = ebp->lr; // initial step size
+  }
+}
+
 void ebpdel(Ebp* ebp) {
   /* Destroy the network. */
-  for (int l = 0; l < ebp->L; l++) {
-    for (int j = 0; j < ebp->N[l]; j++) {
-      free(ebp->dw[l][j]);
-      free(ebp->w[l][j]);
+  if (ebp->pool != NULL) {
+    if (ebp->wk != NULL) {
+      for (int t = 0; t < ebp->T; t++) unworker(ebp->wk[t], ebp);
+      free(ebp->wk);
+      ebp->wk = NULL;
     }
-    free(ebp->dw[l]);
-    free(ebp->w[l]);
-    free(ebp->d[l]);
-    free(ebp->o[l]);
+    pooldel(ebp->pool);
+    ebp->pool = NULL;
   }
-  free(ebp->dw);
-  ebp->dw = NULL;
+  unbuffers(ebp);
+  if (ebp->dw != NULL) undelweights(ebp);
+  unsparsify(ebp);
+  for (int l = 0; l < ebp->L; l++) {
+    if (ebp->m != NULL) unrows(ebp->m[l]);
+    if (ebp->v != NULL) unrows(ebp->v[l]);
+    if (ebp->wt[l] != NULL) unrows(ebp->wt[l]);
+    if (ebp->map == NULL) unrows(ebp->w[l]);
+    else free(ebp->w[l]); // the rows lie in the map
+    free(ebp->act[l]);
+  }
+  if (ebp->map != NULL) munmap(ebp->map, ebp->mapsize);
+  ebp->map = NULL;
+  free(ebp->v);
+  ebp->v = NULL;
+  free(ebp->m);
+  ebp->m = NULL;
+  free(ebp->act);
+  ebp->act = NULL;
+  free(ebp->wt);
+  ebp->wt = NULL;
   free(ebp->w);
   ebp->w = NULL;
-  free(ebp->d);
-  ebp->d = NULL;
-  free(ebp->o);
-  ebp->o = NULL;
-  free(ebp->i);
-  ebp->i = NULL;
-  free(ebp->p);
-  ebp->p = NULL;
+  free(ebp->dfv);
+  ebp->dfv = NULL;
+  free(ebp->fv);
+  ebp->fv = NULL;
   free(ebp->df);
   ebp->df = NULL;
   free(ebp->f);
@@ -132,73 +391,1210 @@ void ebpdel(Ebp* ebp) {
   free(ebp);
 }
 
+static void feed(Ebp* ebp, int l) {
+  /* Feed layer l's input vector forward to its output vector. */
+  const int J = ebp->N[l];
+  const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+  for (int j = 0; j < J; j++) {
+    double net = 0.0;
+    if (l == 0 && ebp->nz != NULL) for (const int* n = ebp->nz; *n >= 0; n++) net += ebp->w[l][j][*n] * ebp->p[*n]; // zero taps add nothing
+    else if (ebp->sw != NULL && ebp->sw[l] != NULL) {
+      const Spm* sw = ebp->sw[l];
+      net = kerdoti(sw->row[j + 1] - sw->row[j], sw->val + sw->row[j], sw->col + sw->row[j], ebp->i[l]); // pruned weights add nothing
+    } else net = kerdot(I + 1, ebp->w[l][j], ebp->i[l]);
+    ebp->o[l][j] = net;
+  }
+  ebp->fv[l](J, ebp->o[l]); // see eq 7, LIR p 6
+}
+
 static void forward(Ebp* ebp, const double* p) {
   /* Feed the pattern p forward. */
-  memcpy(ebp->p, p, ebp->I * sizeof(double)); // network [p] = input [p]; does not overwrite bias node
+  if (ebp->nz == NULL) memcpy(ebp->p, p, ebp->I * sizeof(double)); // network [p] = input [p]; does not overwrite bias node
+  else for (const int* n = ebp->nz; *n < ebp->I; n++) ebp->p[*n] = p[*n]; // only the non-zero taps are read below
   // feed forward pattern
-  for (int l = 0; l < ebp->L; l++) { // from the first layer to the last
-    const int J = ebp->N[l];
-    for (int j = 0; j < J; j++) {
-      const int I = l == 0 ? ebp->I : ebp->N[l - 1];
-      double net = 0.0;
-      for (int i = 0; i <= I; i++) net += ebp->w[l][j][i] * ebp->i[l][i];
-      ebp->o[l][j] = ebp->f[l](net); // see eq 7, LIR p 6
+  for (int l = 0; l < ebp->L; l++) feed(ebp, l); // from the first layer to the last
+}
+
+static void deltas(Ebp* ebp, int l, const double* p) {
+  /* Calculate layer l's deltas from the target pattern p, or from the deltas of the downstream layer. */
+  const int J = ebp->N[l];
+  if (l == ebp->L - 1) { // for output nodes
+    for (int j = 0; j < J; j++) ebp->d[l][j] = p[j] - ebp->o[l][j];
+    ebp->dfv[l](J, ebp->o[l], ebp->d[l]); // see eq 13, LIR p 7
+  } else { // for hidden nodes
+    const int ld = l + 1; // adjacent downstream layer
+    const int K = ebp->N[ld];
+    if (ebp->sw != NULL && ebp->sw[ld] != NULL) { // scatter the downstream deltas along the unpruned weights
+      const Spm* sw = ebp->sw[ld];
+      memset(ebp->d[l], 0, J * sizeof(double));
+      for (int k = 0; k < K; k++)
+        for (int n = sw->row[k]; n < sw->row[k + 1] && sw->col[n] < J; n++) ebp->d[l][sw->col[n]] += ebp->d[ld][k] * sw->val[n]; // bias column last
+    } else if (ebp->wt != NULL) {
+      for (int j = 0; j < J; j++) ebp->d[l][j] = kerdot(K, ebp->wt[ld][j], ebp->d[ld]); // row j of the transpose is column j of w[ld]
+    } else { // no transpose; sum the rows of w[ld] scaled by the downstream deltas instead
+      memset(ebp->d[l], 0, J * sizeof(double));
+      for (int k = 0; k < K; k++) keraxpy(J, ebp->d[ld][k], ebp->w[ld][k], ebp->d[l]);
     }
+    ebp->dfv[l](J, ebp->o[l], ebp->d[l]); // see eq 14, LIR p 7
+  }
+}
+
+static void propagate(Ebp* ebp, int l, const double* p) {
+  /* Calculate layer l's deltas from the target pattern p, or from the deltas of the downstream layer, and its del-weights. */
+  const int J = ebp->N[l];
+  deltas(ebp, l, p);
+  // calculate del-weights
+  const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+  for (int j = 0; j < J; j++) {
+    if (l == 0 && ebp->nz != NULL) { // only the non-zero taps' del-weights change
+      for (const int* n = ebp->nz; *n >= 0; n++) ebp->dw[l][j][*n] = ebp->eta * ebp->d[l][j] * ebp->p[*n] + ebp->alpha * ebp->dw[l][j][*n];
+    } else if (ebp->sw != NULL && ebp->sw[l] != NULL) { // only the unpruned weights' del-weights change; the pruned ones stay zero
+      const Spm* sw = ebp->sw[l];
+      for (int k = sw->row[j]; k < sw->row[j + 1]; k++) ebp->dw[l][j][sw->col[k]] = ebp->eta * ebp->d[l][j] * ebp->i[l][sw->col[k]] + ebp->alpha * ebp->dw[l][j][sw->col[k]];
+    } else keraxpby(I + 1, ebp->eta * ebp->d[l][j], ebp->i[l], ebp->alpha, ebp->dw[l][j]); // see eq 16, LIR p 9
   }
 }
 
 static void backward(Ebp* ebp, const double* p) {
+  /* Propagate the errors against the target pattern p backward. */
+  for (int l = ebp->L - 1; l >= 0; l--) propagate(ebp, l, p); // from the last layer to the first
+}
+
+static void batch(Ebp* ebp, int B, double** ii, double** tt, const int* ord) {
+  /* Feed B patterns forward and propagate their errors backward, one matrix-matrix product per layer and pass.
+   * Row b of every batch matrix belongs to the pattern ord[b]. The del-weights are updated once per batch. */
   const int lo = ebp->L - 1;
+  for (int b = 0; b < B; b++) memcpy(ebp->ib[0] + b * kerpad(ebp->I + 1), ii[ord[b]], ebp->I * sizeof(double)); // does not overwrite bias column
+  // feed forward patterns
+  for (int l = 0; l < ebp->L; l++) { // from the first layer to the last
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    const int S = kerpad(J + 1);
+    double* o = ebp->ob[l];
+    kergemmnt(B, J, I + 1, 1.0, ebp->ib[l], kerpad(I + 1), ebp->w[l][0], kerpad(I + 1), 0.0, o, S); // (net) = (i) * (w)'
+    for (int b = 0; b < B; b++) ebp->fv[l](J, o + b * S); // see eq 7, LIR p 6
+  }
+  // propagate errors backward
   for (int l = lo; l >= 0; l--) { // from the last layer to the first
     const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    const int S = kerpad(J + 1);
+    const double* o = ebp->ob[l];
+    double* d = ebp->db[l];
     // calculate deltas
     if (l == lo) { // for output nodes
-      for (int j = 0; j < J; j++) {
-        double err = p[j] - ebp->o[l][j];
-        ebp->d[l][j] = err * ebp->df[l](ebp->o[l][j]); // see eq 13, LIR p 7
+      for (int b = 0; b < B; b++) {
+        for (int j = 0; j < J; j++) d[b * kerpad(J) + j] = tt[ord[b]][j] - o[b * S + j];
+        ebp->dfv[l](J, o + b * S, d + b * kerpad(J)); // see eq 13, LIR p 7
       }
     } else { // for hidden nodes
       const int ld = l + 1; // adjacent downstream layer
       const int K = ebp->N[ld];
-      for (int j = 0; j < J; j++) {
-        double err = 0.0;
-        for (int k = 0; k < K; k++) err += ebp->w[ld][k][j] * ebp->d[ld][k];
-        ebp->d[l][j] = err * ebp->df[l](ebp->o[l][j]); // see eq 14, LIR p 7
-      }
+      kergemmnn(B, J, K, 1.0, ebp->db[ld], kerpad(K), ebp->w[ld][0], kerpad(J + 1), 0.0, d, kerpad(J)); // (err) = (d) * (w); bias column not read
+      for (int b = 0; b < B; b++) ebp->dfv[l](J, o + b * S, d + b * kerpad(J)); // see eq 14, LIR p 7
     }
     // calculate del-weights
-    for (int j = 0; j < ebp->N[l]; j++) {
-      const int I = l == 0 ? ebp->I : ebp->N[l - 1];
-      for (int i = 0; i <= I; i++) ebp->dw[l][j][i] = ebp->eta * ebp->d[l][j] * ebp->i[l][i] + ebp->alpha * ebp->dw[l][j][i]; // see eq 16, LIR p 9
+    kergemmtn(J, I + 1, B, ebp->eta, d, kerpad(J), ebp->ib[l], kerpad(I + 1), ebp->alpha, ebp->dw[l][0], kerpad(I + 1)); // (dw) = eta * (d)' * (i) + alpha * (dw); see eq 16, LIR p 9
+  }
+}
+
+static void cycle(Ebp* ebp, double** ii, double** tt, int p0, int p1) {
+  /* Present the patterns order[p0 .. p1) one batch at a time, and accumulate their del-weights in dw and their errors in e. */
+  const int lo = ebp->L - 1;
+  if (ebp->B == 1) {
+    for (int p = p0; p < p1; p++) {
+      forward(ebp, ii[ebp->order[p]]);
+      backward(ebp, tt[ebp->order[p]]);
+      for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(ebp->d[lo][j]); // sum of squares error; see LIR p 4
+    }
+  } else {
+    for (int p = p0; p < p1; p += ebp->B) {
+      const int B = p1 - p < ebp->B ? p1 - p : ebp->B; // last batch may be short
+      batch(ebp, B, ii, tt, ebp->order + p);
+      for (int b = 0; b < B; b++)
+        for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(ebp->db[lo][b * kerpad(ebp->N[lo]) + j]); // sum of squares error; see LIR p 4
+    }
+  }
+}
+
+typedef struct Shard {
+  Ebp* ebp; // network whose workers share the cycle
+  double** ii; // input patterns
+  double** tt; // target patterns
+  int P; // number of patterns in the cycle
+  int* n; // number of batches n[t] accumulated in worker t's del-weights
+  int s; // current stride of the reduction tree
+} Shard;
+
+static void work(void* arg, int t) {
+  /* Worker t presents its contiguous share of the cycle's batches, accumulating del-weights from zero.
+   * The momentum rule is linear, so a share's del-weights, decayed by alpha once per later batch, add up to the serial result. */
+  Shard* sh = arg;
+  Ebp* ebp = sh->ebp;
+  Ebp* wk = ebp->wk[t];
+  const int nb = (sh->P + ebp->B - 1) / ebp->B; // number of batches in the cycle
+  const int b0 = (int) ((long) nb * t / ebp->T);
+  const int b1 = (int) ((long) nb * (t + 1) / ebp->T);
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    memset(wk->dw[l][0], 0, ebp->N[l] * kerpad(I + 1) * sizeof(double));
+  }
+  wk->e = 0.0;
+  const int p1 = b1 * ebp->B < sh->P ? b1 * ebp->B : sh->P;
+  cycle(wk, sh->ii, sh->tt, b0 * ebp->B, p1);
+  sh->n[t] = b1 - b0;
+}
+
+static void reduce(void* arg, int t) {
+  /* Fold worker t + s's del-weights into worker t's: (dw_t) = alpha^n * (dw_t) + (dw_t+s), where n is worker t + s's batch count.
+   * Folding in a fixed tree order makes the result reproducible for a given number of threads. */
+  Shard* sh = arg;
+  Ebp* ebp = sh->ebp;
+  const int s = sh->s;
+  if (t % (2 * s) != 0 || t + s >= ebp->T) return;
+  const double a = pow(ebp->alpha, sh->n[t + s]);
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    keraxpby(ebp->N[l] * kerpad(I + 1), 1.0, ebp->wk[t + s]->dw[l][0], a, ebp->wk[t]->dw[l][0]);
+  }
+  sh->n[t] += sh->n[t + s];
+}
+
+static void parallel(Ebp* ebp, double** ii, double** tt, int P) {
+  /* Present the patterns order[0 .. P) on the worker threads, and leave the combined del-weights in dw and the combined error in e. */
+  int n[ebp->T];
+  Shard sh = {.ebp = ebp, .ii = ii, .tt = tt, .P = P, .n = n, .s = 0};
+  poolrun(ebp->pool, work, &sh);
+  for (sh.s = 1; sh.s < ebp->T; sh.s *= 2) poolrun(ebp->pool, reduce, &sh);
+  const double a = pow(ebp->alpha, n[0]); // decay of the previous cycle's del-weights over all the cycle's batches
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    keraxpby(ebp->N[l] * kerpad(I + 1), 1.0, ebp->wk[0]->dw[l][0], a, ebp->dw[l][0]);
+  }
+  for (int t = 0; t < ebp->T; t++) ebp->e += ebp->wk[t]->e;
+}
+
+#define SURVEY 10 // cycles of hogwild worker 0 between its error passes over all the patterns
+#define LAG 2 // most cycles that a hogwild worker runs ahead of the slowest one
+
+typedef struct Wild {
+  Ebp* ebp; // network whose workers share the weights
+  double** ii; // input patterns
+  double** tt; // target patterns
+  int** nz; // non-zero input taps nz[p] of pattern p, then the bias tap I, then -1; NULL for dense input
+  unsigned int* seed; // shuffle seed seed[t] of worker t
+  atomic_int* c; // number of cycles c[t] that worker t ran
+  atomic_bool stop; // error criterion met, or some worker ran C cycles
+} Wild;
+
+static void apply(Ebp* wk) {
+  /* Add the worker's del-weights to the shared weights, without locks; see Hogwild!, Niu (2011). */
+  for (int l = 0; l < wk->L; l++) {
+    const int I = l == 0 ? wk->I : wk->N[l - 1];
+    if (l == 0 && wk->nz != NULL) {
+      for (int j = 0; j < wk->N[l]; j++)
+        for (const int* n = wk->nz; *n >= 0; n++) wk->w[l][j][*n] += wk->dw[l][j][*n]; // only the non-zero taps' weights change
+    } else keraxpy(wk->N[l] * kerpad(I + 1), 1.0, wk->dw[l][0], wk->w[l][0]); // (w) = (w) + (dw)
+  }
+}
+
+static double survey(const Wild* wd, Ebp* wk) {
+  /* Return the sum of squares error of all the patterns under the shared weights as they are now, which the other workers may go on changing. */
+  const int lo = wk->L - 1;
+  double e = 0.0;
+  for (int q = 0; q < wd->ebp->P; q++) {
+    wk->nz = wd->nz == NULL ? NULL : wd->nz[q];
+    forward(wk, wd->ii[q]);
+    deltas(wk, lo, wd->tt[q]);
+    for (int j = 0; j < wk->N[lo]; j++) e += sqre(wk->d[lo][j]); // sum of squares error; see LIR p 4
+  }
+  return e;
+}
+
+static void wild(void* arg, int t) {
+  /* Worker t trains on its own share of the patterns, updating the shared weights after every pattern.
+   * Workers neither lock nor wait for each other; every SURVEY cycles, worker 0 checks the error criterion over all the patterns.
+   * No worker runs more than LAG cycles ahead of the slowest, and the first to run C cycles stops the others, lest they go on training on their
+   * own shares only, and the model forget the rest. */
+  Wild* wd = arg;
+  Ebp* ebp = wd->ebp;
+  Ebp* wk = ebp->wk[t];
+  const int lo = ebp->L - 1;
+  const int p0 = (int) ((long) ebp->P * t / ebp->T);
+  const int p1 = (int) ((long) ebp->P * (t + 1) / ebp->T);
+  const int every = ebp->C / 10 > 0 ? ebp->C / 10 : 1; // as watch() reports
+  int c = 0; // cycles run
+  while (!atomic_load_explicit(&wd->stop, memory_order_relaxed) && c < ebp->C) {
+    if (c >= LAG) { // wait for the slowest worker, so that no share goes untrained for long
+      int m = c;
+      for (int u = 0; u < ebp->T; u++) {
+        const int cu = atomic_load_explicit(&wd->c[u], memory_order_relaxed);
+        m = cu < m ? cu : m;
+      }
+      if (c - m > LAG) {
+        sched_yield();
+        continue;
+      }
+    }
+    if (ebp->shuffle) shuffler(p1 - p0, ebp->order + p0, &wd->seed[t]); // each worker shuffles its own share
+    for (int p = p0; p < p1; p++) {
+      const int q = ebp->order[p];
+      wk->nz = wd->nz == NULL ? NULL : wd->nz[q];
+      forward(wk, wd->ii[q]);
+      backward(wk, wd->tt[q]);
+      apply(wk);
+    }
+    if (t == 0 && (c % SURVEY == 0 || c % every == 0)) {
+      ebp->e = sqrt(survey(wd, wk)) / ebp->N[lo] / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
+      if (!watch(ebp, c) || ebp->e < ebp->epsilon) atomic_store(&wd->stop, true);
+    }
+    atomic_store_explicit(&wd->c[t], ++c, memory_order_relaxed);
+  }
+  atomic_store(&wd->stop, true);
+}
+
+static int hogwild(Ebp* ebp, double** ii, double** tt) {
+  /* Train the network asynchronously, and return the most cycles that a worker ran; see Hogwild!, Niu (2011).
+   * There is no end-of-cycle barrier, so workers drift apart by up to LAG cycles; the error is that of all the patterns, under the weights at the end.
+   * With sparse input, a pattern touches only its non-zero taps' first-layer del-weights, so the momentum of a zero tap is not decayed by alpha
+   * while the tap stays zero: it is frozen, and applied in full the next time the tap turns up. */
+  const int lo = ebp->L - 1;
+  Wild wd = {.ebp = ebp, .ii = ii, .tt = tt, .nz = NULL};
+  wd.seed = malloc(ebp->T * sizeof(unsigned int));
+  wd.c = malloc(ebp->T * sizeof(atomic_int));
+  for (int t = 0; t < ebp->T; t++) {
+    wd.seed[t] = (unsigned int) rnd();
+    atomic_init(&wd.c[t], 0);
+  }
+  atomic_init(&wd.stop, false);
+  if (ebp->sparse) { // list each pattern's non-zero taps, followed by the bias tap
+    wd.nz = malloc(ebp->P * sizeof(int*));
+    for (int p = 0; p < ebp->P; p++) {
+      int n = 0;
+      for (int i = 0; i < ebp->I; i++) n += !iszero(ii[p][i]);
+      wd.nz[p] = malloc((n + 2) * sizeof(int));
+      n = 0;
+      for (int i = 0; i < ebp->I; i++) if (!iszero(ii[p][i])) wd.nz[p][n++] = i;
+      wd.nz[p][n++] = ebp->I;
+      wd.nz[p][n] = -1;
     }
   }
+  poolrun(ebp->pool, wild, &wd);
+  ebp->e = sqrt(survey(&wd, ebp->wk[0])) / ebp->N[lo] / ebp->P; // the workers are done, so this is the error of the final weights
+  int c = 0;
+  for (int t = 0; t < ebp->T; t++) c = atomic_load(&wd.c[t]) > c ? atomic_load(&wd.c[t]) : c;
+  if (wd.nz != NULL) {
+    for (int p = 0; p < ebp->P; p++) free(wd.nz[p]);
+    free(wd.nz);
+  }
+  free(wd.c);
+  free(wd.seed);
+  for (int l = 1; l < ebp->L; l++) transpose(ebp, l);
+  return c;
+}
+
+typedef struct Pipe {
+  Ebp* ebp; // network whose layers are split among the stages
+  double** ii; // input patterns
+  double** tt; // target patterns
+  int S; // number of stages
+  int* cut; // stage s owns layers cut[s] .. cut[s + 1] - 1
+  int W; // number of slots; the most patterns in flight
+  Ebp** slot; // slot networks slot[k], each carrying one pattern's activations and deltas through the stages
+  int* pat; // pattern pat[k] carried by slot k
+  Spsc** fq; // forward queues fq[s] of slots entering stage s from upstream
+  Spsc** bq; // backward queues bq[s] of slots returning to stage s from downstream
+  double e; // sum of squares error of the cycle
+} Pipe;
+
+static Pipe* pipenew(Ebp* ebp, double** ii, double** tt) {
+  /* Split the layers into contiguous stages of roughly equal weight counts, one per thread, and create the slots and queues between them. */
+  Pipe* pp = malloc(sizeof(Pipe));
+  pp->ebp = ebp;
+  pp->ii = ii;
+  pp->tt = tt;
+  pp->S = ebp->T < ebp->L ? ebp->T : ebp->L;
+  pp->cut = malloc((pp->S + 1) * sizeof(int));
+  long W[ebp->L + 1]; // W[l] is the number of weights in the layers before l
+  W[0] = 0;
+  for (int l = 0; l < ebp->L; l++) W[l + 1] = W[l] + (long) ebp->N[l] * ((l == 0 ? ebp->I : ebp->N[l - 1]) + 1);
+  pp->cut[0] = 0;
+  for (int s = 1; s < pp->S; s++) {
+    int l = pp->cut[s - 1] + 1; // at least one layer per stage
+    while (l < ebp->L - (pp->S - s) && W[l] * pp->S < W[ebp->L] * s) l++;
+    pp->cut[s] = l;
+  }
+  pp->cut[pp->S] = ebp->L;
+  pp->W = 4 * pp->S;
+  pp->slot = malloc(pp->W * sizeof(Ebp*));
+  pp->pat = malloc(pp->W * sizeof(int));
+  for (int k = 0; k < pp->W; k++) pp->slot[k] = worker(ebp, false); // all slots accumulate into the network's del-weights
+  pp->fq = malloc(pp->S * sizeof(Spsc*));
+  pp->bq = malloc(pp->S * sizeof(Spsc*));
+  for (int s = 0; s < pp->S; s++) {
+    pp->fq[s] = spscnew(pp->W);
+    pp->bq[s] = spscnew(pp->W);
+  }
+  pp->e = 0.0;
+  return pp;
+}
+
+static void pipedel(Pipe* pp) {
+  /* Destroy the pipeline. */
+  for (int s = 0; s < pp->S; s++) {
+    spscdel(pp->bq[s]);
+    spscdel(pp->fq[s]);
+  }
+  free(pp->bq);
+  free(pp->fq);
+  for (int k = 0; k < pp->W; k++) unworker(pp->slot[k], pp->ebp);
+  free(pp->pat);
+  free(pp->slot);
+  free(pp->cut);
+  free(pp);
+}
+
+static void handoff(Spsc* q, int k) {
+  /* Hand slot k to the next stage; the queue holds every slot, so this never waits in practice. */
+  while (!spscpush(q, k)) sched_yield();
+}
+
+static void stage(void* arg, int s) {
+  /* Stage s feeds its layers forward for each slot that arrives from upstream, and propagates its layers' errors backward for each slot that returns from downstream.
+   * Slots flow through every stage in presentation order, so each layer's del-weights accumulate in the same order as in the serial cycle. */
+  Pipe* pp = arg;
+  if (s >= pp->S) return; // more threads than layers
+  Ebp* ebp = pp->ebp;
+  const int lo = ebp->L - 1;
+  const int l0 = pp->cut[s];
+  const int l1 = pp->cut[s + 1];
+  const bool first = s == 0;
+  const bool last = s == pp->S - 1;
+  int fed = 0, done = 0; // number of patterns this stage has fed forward and propagated backward
+  double e = 0.0;
+  while (done < ebp->P) {
+    bool idle = true;
+    int k;
+    // propagate backward a slot returning from downstream
+    if (!last && spscpop(pp->bq[s], &k)) {
+      for (int l = l1 - 1; l >= l0; l--) propagate(pp->slot[k], l, pp->tt[pp->pat[k]]);
+      if (!first) handoff(pp->bq[s - 1], k);
+      done++;
+      idle = false;
+    }
+    // feed forward a new pattern, or a slot arriving from upstream
+    if (first ? fed < ebp->P && fed - done < pp->W : spscpop(pp->fq[s], &k)) {
+      if (first) { // a slot is free once the first stage has propagated its pattern backward
+        k = fed % pp->W;
+        pp->pat[k] = ebp->order[fed];
+        memcpy(pp->slot[k]->p, pp->ii[pp->pat[k]], ebp->I * sizeof(double)); // does not overwrite bias node
+      }
+      Ebp* sl = pp->slot[k];
+      for (int l = l0; l < l1; l++) feed(sl, l);
+      fed++;
+      if (last) { // turn the slot around
+        for (int l = l1 - 1; l >= l0; l--) propagate(sl, l, pp->tt[pp->pat[k]]);
+        for (int j = 0; j < ebp->N[lo]; j++) e += sqre(sl->d[lo][j]); // sum of squares error; see LIR p 4
+        if (!first) handoff(pp->bq[s - 1], k);
+        done++;
+      } else handoff(pp->fq[s + 1], k);
+      idle = false;
+    }
+    if (idle) sched_yield();
+  }
+  if (last) pp->e = e;
+}
+
+/* optimizers and schedules */
+
+#define RHO 0.9 // RMSprop decay of the squared gradient
+#define BETA1 0.9 // Adam decay of the first moment
+#define BETA2 0.999 // Adam decay of the second moment
+#define DELTA 1.0e-8 // RMSprop and Adam denominator guard
+#define GROW 1.2 // Rprop step size growth, while the gradient keeps its sign
+#define SHRINK 0.5 // Rprop step size shrinkage, when the gradient changes sign
+#define STEPMAX 50.0 // Rprop largest step size
+#define STEPMIN 1.0e-6 // Rprop smallest step size
+#define GAIN 1.0e-4 // relative improvement of the error that resets the plateau
+
+static void pace(Ebp* ebp, Pipe* pp, int c) {
+  /* Set cycle c's learning rate; the previous cycle's error in e drives the PLATEAU schedule.
+   * Under MOMENTUM, the rate is eta, of which the workers and the pipeline slots have their own copies. */
+  switch (ebp->sched) {
+    case CONSTANT:
+      ebp->rate = ebp->lr;
+      break;
+    case STEP:
+      ebp->rate = ebp->lr * pow(ebp->decay, c / ebp->period);
+      break;
+    case COSINE:
+      ebp->rate = 0.5 * ebp->lr * (1.0 + cos(M_PI * c / ebp->C));
+      break;
+    case PLATEAU:
+      if (c == 0) ebp->rate = ebp->lr;
+      else if (ebp->e < ebp->best * (1.0 - GAIN)) {
+        ebp->best = ebp->e;
+        ebp->stall = 0;
+      } else if (++ebp->stall >= ebp->period) {
+        ebp->rate *= ebp->decay;
+        ebp->stall = 0;
+      }
+      break;
+  }
+  if (ebp->opt != MOMENTUM) return;
+  ebp->eta = ebp->rate;
+  if (ebp->wk != NULL)
+    for (int t = 0; t < ebp->T; t++) ebp->wk[t]->eta = ebp->rate;
+  if (pp != NULL)
+    for (int k = 0; k < pp->W; k++) pp->slot[k]->eta = ebp->rate;
+}
+
+static void update(Ebp* ebp) {
+  /* Update the weights at the end of a cycle, by the network's optimizer.
+   * Each layer's rows form one block, so each rule is one pass over the block; the padding's gradient is zero, so the padding stays zero. */
+  if (ebp->opt == ADAM) ebp->k++;
+  const double c1 = 1.0 - pow(BETA1, (double) ebp->k); // bias corrections; see Algorithm 1, Kingma (2015)
+  const double c2 = 1.0 - pow(BETA2, (double) ebp->k);
+  for (int l = 0; l < ebp->L; l++) {
+    const int n = ebp->N[l] * kerpad((l == 0 ? ebp->I : ebp->N[l - 1]) + 1);
+    double* restrict w = ebp->w[l][0];
+    double* restrict g = ebp->dw[l][0]; // under the adaptive optimizers, the cycle's gradient, pointing downhill
+    double* restrict m = ebp->m == NULL ? NULL : ebp->m[l][0];
+    double* restrict v = ebp->v == NULL ? NULL : ebp->v[l][0];
+    switch (ebp->opt) {
+      case MOMENTUM:
+        keraxpy(n, 1.0, g, w); // (w) = (w) + (dw)
+        break;
+      case RMSPROP:
+        for (int k = 0; k < n; k++) {
+          v[k] = RHO * v[k] + (1.0 - RHO) * g[k] * g[k];
+          w[k] += ebp->rate * g[k] / (sqrt(v[k]) + DELTA);
+        }
+        break;
+      case ADAM:
+        for (int k = 0; k < n; k++) {
+          m[k] = BETA1 * m[k] + (1.0 - BETA1) * g[k];
+          v[k] = BETA2 * v[k] + (1.0 - BETA2) * g[k] * g[k];
+          w[k] += ebp->rate * (m[k] / c1) / (sqrt(v[k] / c2) + DELTA);
+        }
+        break;
+      case RPROP:
+        for (int k = 0; k < n; k++) {
+          const double s = g[k] * m[k];
+          if (s > 0.0) v[k] = fmin(v[k] * GROW, STEPMAX);
+          else if (s < 0.0) {
+            v[k] = fmax(v[k] * SHRINK, STEPMIN);
+            g[k] = 0.0; // skip the step, and the next cycle's sign test, after a sign change
+          }
+          w[k] += g[k] > 0.0 ? v[k] : g[k] < 0.0 ? -v[k] : 0.0;
+          m[k] = g[k];
+        }
+        break;
+      case LM:
+      case LBFGS:
+        break; // see second()
+    }
+    if (ebp->opt != MOMENTUM) memset(g, 0, n * sizeof(double)); // the next cycle's gradient sums from zero
+    transpose(ebp, l);
+  }
+}
+
+static void finish(const Ebp* ebp, int c, double secs) {
+  /* Report the number of cycles and the wall time that the training took. */
+  if (ebp->watch != NULL) return;
+  printf("%s %s after %d cycles in %.3f s\n", ebp->name, ebp->e < ebp->epsilon ? "met epsilon" : "stopped", c, secs);
+}
+
+/* second-order training */
+
+#define MU 1.0e-3 // initial Levenberg-Marquardt damping
+#define MUSTEP 10.0 // damping factor after each failed or successful step
+#define MUMAX 1.0e10 // largest damping; beyond it, the step is too short to matter
+#define MEMORY 10 // number of L-BFGS correction pairs kept
+#define ARMIJO 1.0e-4 // sufficient decrease of the line search; see eq 3.4, Nocedal (2006)
+#define HALVES 40 // most halvings of the line search step
+
+static void gather(const Ebp* ebp, double*** a, double* x) {
+  /* Flatten the rows of a, the weights or the del-weights, without their padding, into x. */
+  for (int l = 0, k = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    for (int j = 0; j < ebp->N[l]; j++, k += I + 1) memcpy(x + k, a[l][j], (I + 1) * sizeof(double));
+  }
+}
+
+static void scatter(Ebp* ebp, const double* x) {
+  /* Set the weights from the flat vector x, and refresh their transposes. */
+  for (int l = 0, k = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    for (int j = 0; j < ebp->N[l]; j++, k += I + 1) memcpy(ebp->w[l][j], x + k, (I + 1) * sizeof(double));
+    transpose(ebp, l);
+  }
+}
+
+static double sse(Ebp* ebp, double** ii, double** tt, double* ed) {
+  /* Return the sum of squares of the output errors over all the patterns, and leave that of the output deltas, the training error of learn(), in ed. */
+  const int lo = ebp->L - 1;
+  double e = 0.0;
+  *ed = 0.0;
+  for (int p = 0; p < ebp->P; p++) {
+    forward(ebp, ii[p]);
+    for (int j = 0; j < ebp->N[lo]; j++) e += sqre(ebp->d[lo][j] = tt[p][j] - ebp->o[lo][j]);
+    ebp->dfv[lo](ebp->N[lo], ebp->o[lo], ebp->d[lo]);
+    for (int j = 0; j < ebp->N[lo]; j++) *ed += sqre(ebp->d[lo][j]);
+  }
+  return e;
+}
+
+static double gradient(Ebp* ebp, double** ii, double** tt, double* g, double* ed) {
+  /* Leave the gradient of half the sum of squares error in g, return the sum of squares error, and leave that of the output deltas in ed.
+   * With eta and alpha both 1.0, the momentum rule sums the patterns' del-weights, which point downhill, in dw. */
+  for (int l = 0; l < ebp->L; l++) memset(ebp->dw[l][0], 0, ebp->N[l] * kerpad((l == 0 ? ebp->I : ebp->N[l - 1]) + 1) * sizeof(double));
+  ebp->eta = ebp->alpha = 1.0;
+  const int lo = ebp->L - 1;
+  double e = 0.0;
+  *ed = 0.0;
+  for (int p = 0; p < ebp->P; p++) {
+    forward(ebp, ii[p]);
+    for (int j = 0; j < ebp->N[lo]; j++) e += sqre(tt[p][j] - ebp->o[lo][j]);
+    backward(ebp, tt[p]);
+    for (int j = 0; j < ebp->N[lo]; j++) *ed += sqre(ebp->d[lo][j]); // sum of squares error; see LIR p 4
+  }
+  const int n = weights(ebp);
+  gather(ebp, ebp->dw, g);
+  for (int k = 0; k < n; k++) g[k] = -g[k];
+  return e;
+}
+
+static bool cholesky(int n, double* a) {
+  /* Factor the symmetric positive definite matrix a = (l)(l)' in place, into its lower triangle; return false if a is not positive definite. */
+  for (int j = 0; j < n; j++) {
+    double s = a[j * n + j];
+    for (int k = 0; k < j; k++) s -= a[j * n + k] * a[j * n + k];
+    if (s <= 0.0) return false;
+    a[j * n + j] = sqrt(s);
+    for (int i = j + 1; i < n; i++) {
+      double t = a[i * n + j];
+      for (int k = 0; k < j; k++) t -= a[i * n + k] * a[j * n + k];
+      a[i * n + j] = t / a[j * n + j];
+    }
+  }
+  return true;
+}
+
+static void solve(int n, const double* a, double* x) {
+  /* Solve (l)(l)' (x) = (b) in place, with the factor l from cholesky(), and (b) in x. */
+  for (int i = 0; i < n; i++) { // (l) (z) = (b)
+    double s = x[i];
+    for (int k = 0; k < i; k++) s -= a[i * n + k] * x[k];
+    x[i] = s / a[i * n + i];
+  }
+  for (int i = n - 1; i >= 0; i--) { // (l)' (x) = (z)
+    double s = x[i];
+    for (int k = i + 1; k < n; k++) s -= a[k * n + i] * x[k];
+    x[i] = s / a[i * n + i];
+  }
+}
+
+static void marquardt(Ebp* ebp, double** ii, double** tt) {
+  /* Train the network by Levenberg-Marquardt; see Hagan (1994).
+   * Each iteration forms the normal matrix (J)'(J) and the vector (J)'(r) of the Jacobian J of the outputs and the errors r = t - o over all the patterns,
+   * and solves ((J)'(J) + mu (I)) (dw) = (J)'(r), raising the damping mu until the step lowers the error, and lowering it after each success.
+   * Row (p, k) of the Jacobian is the del-weights that backward() computes with eta 1.0 and alpha 0.0, for a target that differs from the output o[k] by 1.0. */
+  const int lo = ebp->L - 1;
+  const int K = ebp->N[lo];
+  const int n = weights(ebp);
+  double* x = malloc(n * sizeof(double)); // weights
+  double* z = malloc(n * sizeof(double)); // Jacobian row, then trial weights
+  double* b = malloc(n * sizeof(double)); // (J)'(r), then the step
+  double* h = malloc(n * n * sizeof(double)); // (J)'(J)
+  double* a = malloc(n * n * sizeof(double)); // (J)'(J) + mu (I), then its Cholesky factor
+  double t[K]; // unit-error target
+  double mu = MU;
+  gather(ebp, ebp->w, x);
+  ebp->eta = 1.0;
+  ebp->alpha = 0.0; // (dw) = (d)' * (i)
+  int c = 0;
+  const double t0 = now();
+  for (bool go = true; go && ebp->e > ebp->epsilon && c < ebp->C; c++) {
+    // form the normal equations
+    memset(h, 0, n * n * sizeof(double));
+    memset(b, 0, n * sizeof(double));
+    double e = 0.0;
+    for (int p = 0; p < ebp->P; p++) {
+      forward(ebp, ii[p]);
+      for (int k = 0; k < K; k++) {
+        const double r = tt[p][k] - ebp->o[lo][k];
+        e += r * r;
+        for (int j = 0; j < K; j++) t[j] = ebp->o[lo][j] + (j == k ? 1.0 : 0.0);
+        backward(ebp, t);
+        gather(ebp, ebp->dw, z);
+        for (int u = 0; u < n; u++) {
+          if (z[u] == 0.0) continue; // a weight that does not lead to output k
+          b[u] += z[u] * r;
+          for (int v = 0; v <= u; v++) h[u * n + v] += z[u] * z[v]; // lower triangle; cholesky() reads no more
+        }
+      }
+    }
+    // damp until the step lowers the error
+    double e1 = e;
+    double ed = ebp->e; // training error at the new weights
+    for (; mu <= MUMAX; mu *= MUSTEP) {
+      memcpy(a, h, n * n * sizeof(double));
+      for (int u = 0; u < n; u++) a[u * n + u] += mu;
+      if (!cholesky(n, a)) continue;
+      memcpy(z, b, n * sizeof(double));
+      solve(n, a, z);
+      for (int u = 0; u < n; u++) z[u] += x[u];
+      scatter(ebp, z);
+      e1 = sse(ebp, ii, tt, &ed);
+      if (e1 < e) break;
+    }
+    if (e1 < e) {
+      memcpy(x, z, n * sizeof(double));
+      mu = fmax(mu / MUSTEP, 1.0e-12);
+    } else {
+      scatter(ebp, x); // no step lowers the error; a minimum
+      go = false;
+    }
+    // report training error
+    if (go) ebp->e = sqrt(ed) / K / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
+    if (go) go = watch(ebp, c);
+  }
+  finish(ebp, c, now() - t0);
+  free(a);
+  free(h);
+  free(b);
+  free(z);
+  free(x);
+}
+
+static void lbfgs(Ebp* ebp, double** ii, double** tt) {
+  /* Train the network by limited-memory BFGS; see Algorithm 7.4, Nocedal (2006).
+   * The last few weight and gradient changes stand in for the inverse Hessian, so memory grows only linearly with the weights. */
+  const int lo = ebp->L - 1;
+  const int n = weights(ebp);
+  double* x = malloc(n * sizeof(double)); // weights
+  double* g = malloc(n * sizeof(double)); // gradient
+  double* d = malloc(n * sizeof(double)); // search direction
+  double* z = malloc(n * sizeof(double)); // trial weights, then trial gradient
+  double* s = malloc(MEMORY * n * sizeof(double)); // weight changes s[m * n + k]
+  double* y = malloc(MEMORY * n * sizeof(double)); // gradient changes y[m * n + k]
+  double rho[MEMORY], q[MEMORY];
+  int M = 0; // number of correction pairs kept; pair m lies at m % MEMORY
+  gather(ebp, ebp->w, x);
+  double ed; // training error of learn()
+  double f = 0.5 * gradient(ebp, ii, tt, g, &ed);
+  int c = 0;
+  const double t0 = now();
+  for (bool go = true; go && ebp->e > ebp->epsilon && c < ebp->C; c++) {
+    // two-loop recursion; (d) = -(H)(g)
+    for (int k = 0; k < n; k++) d[k] = -g[k];
+    const int m0 = M > MEMORY ? M - MEMORY : 0;
+    for (int m = M - 1; m >= m0; m--) {
+      const double* sm = s + (m % MEMORY) * n;
+      q[m % MEMORY] = rho[m % MEMORY] * kerdot(n, sm, d);
+      keraxpy(n, -q[m % MEMORY], y + (m % MEMORY) * n, d);
+    }
+    if (M > 0) { // scale by the latest curvature; see eq 7.20, Nocedal (2006)
+      const double* sm = s + ((M - 1) % MEMORY) * n;
+      const double* ym = y + ((M - 1) % MEMORY) * n;
+      const double gamma = kerdot(n, sm, ym) / kerdot(n, ym, ym);
+      for (int k = 0; k < n; k++) d[k] *= gamma;
+    }
+    for (int m = m0; m < M; m++) {
+      const double beta = rho[m % MEMORY] * kerdot(n, y + (m % MEMORY) * n, d);
+      keraxpy(n, q[m % MEMORY] - beta, s + (m % MEMORY) * n, d);
+    }
+    double slope = kerdot(n, g, d);
+    if (slope >= 0.0) { // not a descent direction; start over from steepest descent
+      for (int k = 0; k < n; k++) d[k] = -g[k];
+      slope = kerdot(n, g, d);
+      M = 0;
+    }
+    // backtracking line search
+    double a = M == 0 ? fmin(1.0, 1.0 / sqrt(-slope)) : 1.0; // the first step is unscaled, so keep it short
+    double f1 = f;
+    int h = 0;
+    for (; h < HALVES; h++, a *= 0.5) {
+      for (int k = 0; k < n; k++) z[k] = x[k] + a * d[k];
+      scatter(ebp, z);
+      f1 = 0.5 * sse(ebp, ii, tt, &ed);
+      if (f1 <= f + ARMIJO * a * slope) break; // see eq 3.4, Nocedal (2006)
+    }
+    if (h == HALVES) {
+      scatter(ebp, x); // no step lowers the error; a minimum
+      go = false;
+    } else {
+      // keep the correction pair
+      double* sm = s + (M % MEMORY) * n;
+      double* ym = y + (M % MEMORY) * n;
+      for (int k = 0; k < n; k++) {
+        sm[k] = z[k] - x[k];
+        ym[k] = -g[k];
+      }
+      memcpy(x, z, n * sizeof(double));
+      f = 0.5 * gradient(ebp, ii, tt, g, &ed);
+      keraxpy(n, 1.0, g, ym);
+      const double sy = kerdot(n, sm, ym);
+      if (sy > 1.0e-12) { // skip a pair that would break the positive definiteness
+        rho[M % MEMORY] = 1.0 / sy;
+        M++;
+      }
+    }
+    // report training error
+    if (go) ebp->e = sqrt(ed) / ebp->N[lo] / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
+    if (go) go = watch(ebp, c);
+  }
+  finish(ebp, c, now() - t0);
+  free(y);
+  free(s);
+  free(z);
+  free(d);
+  free(g);
+  free(x);
+}
+
+static void second(Ebp* ebp, double** ii, double** tt) {
+  /* Train the network by a second-order method over the whole pattern set, one pattern at a time on the calling thread.
+   * The methods minimize the sum of squares of the output errors, but stop on the training error of learn(), so that epsilon means the same to all optimizers. */
+  const double eta = ebp->eta;
+  const double alpha = ebp->alpha;
+  if (ebp->watch == NULL) printf("%s over %d weights\n", ebp->opt == LM ? "Levenberg-Marquardt" : "L-BFGS", weights(ebp));
+  if (ebp->opt == LM) marquardt(ebp, ii, tt);
+  else lbfgs(ebp, ii, tt);
+  ebp->eta = eta;
+  ebp->alpha = alpha;
+}
+
+/* pruning */
+
+#define GAUGE 0.2 // least time (in seconds) that gauge() spends timing each forward pass
+
+static double kth(long n, double* a, long k) {
+  /* Return the k-th smallest of the n values in a, counting from 0; reorders a. See FIND, Hoare (1961). */
+  long lo = 0, hi = n - 1;
+  while (lo < hi) {
+    const double x = a[(lo + hi) / 2];
+    long i = lo, j = hi;
+    while (i <= j) {
+      while (a[i] < x) i++;
+      while (a[j] > x) j--;
+      if (i <= j) {
+        const double t = a[i];
+        a[i++] = a[j];
+        a[j--] = t;
+      }
+    }
+    if (k <= j) hi = j;
+    else if (k >= i) lo = i;
+    else break; // a[j + 1 .. i - 1] all equal x
+  }
+  return a[k];
+}
+
+static void cut(Ebp* ebp, double s) {
+  /* Zero the fraction s of each layer's weights that are smallest in magnitude, the bias weights aside.
+   * Their del-weights and first moments are zeroed too, so that no optimizer moves them again before the next cut. */
+  for (int l = 0; l < ebp->L; l++) {
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    const long n = (long) J * I;
+    const long k = (long) (s * n); // number of weights to prune
+    if (k == 0) continue;
+    double* a = malloc(n * sizeof(double));
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i < I; i++) a[(long) j * I + i] = fabs(ebp->w[l][j][i]);
+    const double th = kth(n, a, k - 1); // magnitude threshold
+    free(a);
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i < I; i++) {
+        if (fabs(ebp->w[l][j][i]) > th) continue;
+        ebp->w[l][j][i] = 0.0;
+        ebp->dw[l][j][i] = 0.0;
+        if (ebp->m != NULL) ebp->m[l][j][i] = 0.0;
+      }
+    transpose(ebp, l);
+  }
+}
+
+static int ramp(const Ebp* ebp) {
+  /* Number of cycles over which the pruning ramps up: the first half of the cycles. */
+  return ebp->C / 2 > 0 ? ebp->C / 2 : 1;
+}
+
+static bool thin(Ebp* ebp, int c) {
+  /* Prune the network at the end of cycle c, to a sparsity that ramps up to the target along a cubic over the first half of the cycles; see eq 1, Zhu (2017).
+   * The weights left recover from each small cut in the cycles after it. Return true until the ramp ends, for training goes on until then, whatever the error. */
+  if (ebp->prune <= 0.0) return false;
+  const int R = ramp(ebp);
+  const double r = c + 1 < R ? (double) (c + 1) / R : 1.0;
+  cut(ebp, ebp->prune * (1.0 - pow(1.0 - r, 3.0)));
+  sparsify(ebp);
+  return c + 1 < R;
+}
+
+void ebpprune(Ebp* ebp, double sparsity) {
+  /* Prune the fraction sparsity of each layer's weights that are smallest in magnitude at once, the bias weights aside, and run the layers that are sparse enough on CSR weights.
+   * Whereas learn() prunes a network gradually while it trains, this prunes a trained one, which usually loses some accuracy. */
+  if (ebp->dw == NULL) {
+    fprintf(stderr, "ERROR: network %s was loaded for inference only\n", ebp->name);
+    exit(1);
+  }
+  ebp->prune = sparsity;
+  cut(ebp, sparsity);
+  sparsify(ebp);
+}
+
+static double pass(Ebp* ebp, int P, double** ii) {
+  /* Time the forward pass of the P patterns, repeated for at least GAUGE seconds, and return its time per pattern (in seconds). */
+  long n = 0;
+  const double t0 = now();
+  double t = t0;
+  while (t - t0 < GAUGE) {
+    for (int p = 0; p < P; p++) forward(ebp, ii[p]);
+    n += P;
+    t = now();
+  }
+  return (t - t0) / (double) n;
+}
+
+void gauge(Ebp* ebp, int P, double** ii) {
+  /* Report the pruned network's sparsity and size, and time its forward pass over the P patterns against that of the same weights run dense. */
+  long n = 0, z = 0; // number of weights, and of pruned weights
+  size_t sb = 0, db = 0; // size of the weights (in bytes), sparse and dense
+  int S = 0; // number of sparse layers
+  for (int l = 0; l < ebp->L; l++) {
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i < I; i++) z += ebp->w[l][j][i] == 0.0;
+    n += (long) J * I;
+    const size_t b = (size_t) J * kerpad(I + 1) * sizeof(double);
+    db += b;
+    if (ebp->sw != NULL && ebp->sw[l] != NULL) {
+      const Spm* sw = ebp->sw[l];
+      sb += (J + 1) * sizeof(int) + sw->row[J] * (sizeof(int) + sizeof(double));
+      S++;
+    } else sb += b;
+  }
+  Spm** sw = ebp->sw;
+  const double ts = pass(ebp, P, ii);
+  ebp->sw = NULL; // run every layer dense
+  const double td = pass(ebp, P, ii);
+  ebp->sw = sw;
+  printf("prune %s: %ld of %ld weights (%.1f%%) pruned, %d of %d layers sparse, %zu bytes against %zu dense\n", ebp->name, z, n, 100.0 * z / n, S, ebp->L, sb, db);
+  printf("  forward pass %.3f us per pattern against %.3f us dense; speedup %.2fx\n", ts * 1.0e6, td * 1.0e6, td / ts);
+}
+
+/* checkpoints */
+
+static void snapshot(Ebp* ebp, int c) {
+  /* Checkpoint the training state at the end of cycle c, if a checkpoint is due; the writer thread writes it out. */
+  Ckp* ck = ebp->ckp;
+  if (ck == NULL || !ckpbegin(ck, c)) return;
+  const int32_t hd[5] = {ebp->L, ebp->I, ebp->P, ebp->opt, c + 1}; // topology, then the next cycle
+  const unsigned int rng = rngstate();
+  ckpput(ck, hd, sizeof(hd));
+  ckpput(ck, ebp->N, ebp->L * sizeof(int));
+  ckpput(ck, &ebp->e, sizeof(double));
+  ckpput(ck, &rng, sizeof(rng));
+  ckpput(ck, &ebp->rate, sizeof(double));
+  ckpput(ck, &ebp->best, sizeof(double));
+  ckpput(ck, &ebp->stall, sizeof(int));
+  ckpput(ck, &ebp->k, sizeof(long));
+  ckpput(ck, ebp->order, ebp->P * sizeof(int));
+  for (int l = 0; l < ebp->L; l++) {
+    const size_t n = (size_t) ebp->N[l] * kerpad((l == 0 ? ebp->I : ebp->N[l - 1]) + 1) * sizeof(double);
+    ckpput(ck, ebp->w[l][0], n);
+    ckpput(ck, ebp->dw[l][0], n);
+    if (ebp->m != NULL) ckpput(ck, ebp->m[l][0], n);
+    if (ebp->v != NULL) ckpput(ck, ebp->v[l][0], n);
+  }
+  ckpend(ck);
+}
+
+void ebpresume(Ebp* ebp, Ckp* ck) {
+  /* Restore the training state from the opened checkpoint, so that learn() picks up where the checkpoint left off, with the same results as if it had never stopped.
+   * The network must have been created, and given its optimizer, as the checkpointed one was; the calling thread's random sequence resumes too. */
+  int32_t hd[5];
+  ckpget(ck, hd, sizeof(hd));
+  bool fit = hd[0] == ebp->L && hd[1] == ebp->I && hd[2] == ebp->P && hd[3] == (int32_t) ebp->opt;
+  for (int l = 0; fit && l < ebp->L; l++) {
+    int n;
+    ckpget(ck, &n, sizeof(int));
+    fit = n == ebp->N[l];
+  }
+  if (!fit) {
+    fprintf(stderr, "ERROR: checkpoint %s does not fit network %s\n", ck->file, ebp->name);
+    exit(1);
+  }
+  unsigned int rng;
+  ebp->c0 = hd[4];
+  ckpget(ck, &ebp->e, sizeof(double));
+  ckpget(ck, &rng, sizeof(rng));
+  ckpget(ck, &ebp->rate, sizeof(double));
+  ckpget(ck, &ebp->best, sizeof(double));
+  ckpget(ck, &ebp->stall, sizeof(int));
+  ckpget(ck, &ebp->k, sizeof(long));
+  ckpget(ck, ebp->order, ebp->P * sizeof(int));
+  for (int l = 0; l < ebp->L; l++) {
+    const size_t n = (size_t) ebp->N[l] * kerpad((l == 0 ? ebp->I : ebp->N[l - 1]) + 1) * sizeof(double);
+    ckpget(ck, ebp->w[l][0], n);
+    ckpget(ck, ebp->dw[l][0], n);
+    if (ebp->m != NULL) ckpget(ck, ebp->m[l][0], n);
+    if (ebp->v != NULL) ckpget(ck, ebp->v[l][0], n);
+    transpose(ebp, l);
+  }
+  rngseed(rng);
+  if (ebp->prune > 0.0) sparsify(ebp); // as thin() left it
 }
 
 void learn(Ebp* ebp, double** ii, double** tt) {
-  /* Train the network.
+  /* Train the network, from cycle c0, and checkpoint its state into ckp, if any, every so many cycles.
    * ii[]: input patterns
    * tt[]: associated target patterns (to calculate recall errors) */
-  printf("learn %s\n", ebp->name);
+  if (ebp->watch == NULL) printf("learn %s\n", ebp->name);
+  if (ebp->dw == NULL) {
+    fprintf(stderr, "ERROR: network %s was loaded for inference only\n", ebp->name);
+    exit(1);
+  }
+  if (ebp->opt == LM || ebp->opt == LBFGS || ebp->mode == HOGWILD) { // no end-of-cycle update to prune after; prune at the end
+    unsparsify(ebp); // the weights change below
+    if (ebp->mode == HOGWILD) {
+      const double t0 = now();
+      const int c = hogwild(ebp, ii, tt);
+      finish(ebp, c, now() - t0);
+    } else second(ebp, ii, tt);
+    if (ebp->prune > 0.0) ebpprune(ebp, ebp->prune);
+    return;
+  }
   const int lo = ebp->L - 1;
-  for (int c = 0; ebp->e > ebp->epsilon && c < ebp->C; c++) {
+  const double t0 = now();
+  Pipe* pp = ebp->mode == PIPELINE ? pipenew(ebp, ii, tt) : NULL;
+  int c = ebp->c0;
+  for (bool go = true, pruning = ebp->prune > 0.0 && c < ramp(ebp); go && (pruning || ebp->e > ebp->epsilon) && c < ebp->C; c++) {
     // learn one cycle
+    pace(ebp, pp, c);
     if (ebp->shuffle) shuffle(ebp->P, ebp->order);
     ebp->e = 0.0;
-    for (int p = 0; p < ebp->P; p++) {
-      forward(ebp, ii[ebp->order[p]]);
-      backward(ebp, tt[ebp->order[p]]);
+    if (pp != NULL) {
+      poolrun(ebp->pool, stage, pp);
+      ebp->e = pp->e;
+    } else if (ebp->T == 1) cycle(ebp, ii, tt, 0, ebp->P);
+    else parallel(ebp, ii, tt, ebp->P);
+    // update weights at end of cycle
+    update(ebp);
+    pruning = thin(ebp, c);
+    if (pp != NULL)
+      for (int k = 0; k < pp->W; k++) pp->slot[k]->sw = ebp->sw; // the slots are no workers of ebp; see share()
+    // report training error
+    ebp->e = sqrt(ebp->e) / ebp->N[lo] / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
+    go = watch(ebp, c);
+    snapshot(ebp, c);
+  }
+  if (pp != NULL) pipedel(pp);
+  finish(ebp, c, now() - t0);
+}
+
+void learnstream(Ebp* ebp, Stream* st) {
+  /* Train the network on patterns streamed from their files one chunk at a time; see learn().
+   * The stream shuffles the patterns, so the presentation order within each chunk is the stream's order.
+   * Only the SYNC mode is supported; with T > 1, the workers share each chunk. */
+  if (ebp->watch == NULL) printf("learn %s (streamed in chunks of %d)\n", ebp->name, st->Q);
+  if (ebp->dw == NULL || ebp->mode != SYNC || ebp->opt == LM || ebp->opt == LBFGS) {
+    fprintf(stderr, "ERROR: network %s cannot learn from a stream\n", ebp->name);
+    exit(1);
+  }
+  const int lo = ebp->L - 1;
+  const double t0 = now();
+  for (int p = 0; p < st->Q; p++) ebp->order[p] = p;
+  int c = 0;
+  for (bool go = true, pruning = ebp->prune > 0.0; go && (pruning || ebp->e > ebp->epsilon) && c < ebp->C; c++) {
+    // learn one cycle, chunk by chunk
+    pace(ebp, NULL, c);
+    ebp->e = 0.0;
+    double** ii, ** tt;
+    for (int n; (n = stmnext(st, &ii, &tt)) > 0;) {
+      if (ebp->T == 1) cycle(ebp, ii, tt, 0, n);
+      else parallel(ebp, ii, tt, n);
+    }
+    // update weights at end of cycle
+    update(ebp);
+    pruning = thin(ebp, c);
+    // report training error
+    ebp->e = sqrt(ebp->e) / ebp->N[lo] / st->P; // root-mean-square error; see eq 4.35, ANS p 196
+    go = watch(ebp, c);
+  }
+  finish(ebp, c, now() - t0);
+}
+
+void recallstream(Ebp* ebp, Stream* st) {
+  /* Test the network on patterns streamed from their files; report only the recall error, for there may be too many patterns to show. */
+  printf("recall %s\n", ebp->name);
+  const int lo = ebp->L - 1;
+  ebp->e = 0.0;
+  double** ii, ** tt;
+  for (int n; (n = stmnext(st, &ii, &tt)) > 0;)
+    for (int p = 0; p < n; p++) {
+      forward(ebp, ii[p]);
+      for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(tt[p][j] - ebp->o[lo][j]);
+    }
+  ebp->e = sqrt(ebp->e) / ebp->N[lo] / st->P;
+  report(ebp, -1);
+}
+
+/* sparse input */
+
+typedef struct Lazy { // first layer laid out by column, for input patterns stored sparse
+  int S; // column stride; kerpad(N[0])
+  double* wc; // input weights wc[i * S + j] = w[0][j][i], then the bias weights in column I
+  double* sc; // del-weights sc[i * S + j] of the non-base input values, decayed lazily, then the bias del-weights in column I
+  double* r; // del-weight r[j] of the base input value, common to all of node j's input weights
+  double* rs; // net input rs[j] of node j from an input pattern of base values only
+  int* at; // number of patterns at[i] whose momentum decay column i of sc has had
+  double* ap; // powers ap[k] = alpha^k
+} Lazy;
+
+static Lazy* lazynew(const Ebp* ebp) {
+  /* Allocate the column-major first layer of the network. */
+  Lazy* lz = malloc(sizeof(Lazy));
+  const int J = ebp->N[0];
+  lz->S = kerpad(J);
+  lz->wc = keralloc((ebp->I + 1) * lz->S);
+  lz->sc = keralloc((ebp->I + 1) * lz->S);
+  lz->r = keralloc(J);
+  lz->rs = keralloc(J);
+  lz->at = calloc(ebp->I, sizeof(int));
+  lz->ap = malloc((ebp->P + 2) * sizeof(double));
+  return lz;
+}
+
+static void lazydel(Lazy* lz) {
+  /* Free the column-major first layer. */
+  free(lz->ap);
+  free(lz->at);
+  free(lz->rs);
+  free(lz->r);
+  free(lz->sc);
+  free(lz->wc);
+  free(lz);
+}
+
+static void lazyload(const Ebp* ebp, Lazy* lz, double base) {
+  /* Copy the first layer's weights, and its del-weights if any, into columns, and sum each node's net input from base values. */
+  const int J = ebp->N[0];
+  const int I = ebp->I;
+  for (int j = 0; j < J; j++) {
+    double rs = 0.0;
+    for (int i = 0; i <= I; i++) {
+      lz->wc[i * lz->S + j] = ebp->w[0][j][i];
+      if (ebp->dw != NULL) lz->sc[i * lz->S + j] = ebp->dw[0][j][i];
+      if (i < I) rs += ebp->w[0][j][i];
+    }
+    lz->rs[j] = base * rs;
+    lz->r[j] = 0.0;
+  }
+  lz->ap[0] = 1.0;
+  for (int k = 1; k < ebp->P + 2; k++) lz->ap[k] = lz->ap[k - 1] * ebp->alpha;
+}
+
+static void lazystore(Ebp* ebp, Lazy* lz, int P) {
+  /* Bring every column of the del-weights up to the end of the cycle's P patterns, and add the base del-weights back into the first layer's del-weights. */
+  const int J = ebp->N[0];
+  const int I = ebp->I;
+  for (int i = 0; i < I; i++) {
+    if (lz->at[i] < P)
+      for (int j = 0; j < J; j++) lz->sc[i * lz->S + j] *= lz->ap[P - lz->at[i]];
+    lz->at[i] = 0;
+  }
+  for (int j = 0; j < J; j++) {
+    for (int i = 0; i < I; i++) ebp->dw[0][j][i] = lz->sc[i * lz->S + j] + lz->r[j];
+    ebp->dw[0][j][I] = lz->sc[I * lz->S + j];
+  }
+}
+
+static void feedsparse(Ebp* ebp, const Lazy* lz, const Spm* x, int q) {
+  /* Feed the sparse pattern q forward; the first layer's cost grows with the pattern's non-base taps, not with all the taps. */
+  const int J = ebp->N[0];
+  double* o = ebp->o[0];
+  for (int j = 0; j < J; j++) o[j] = lz->wc[ebp->I * lz->S + j] + lz->rs[j]; // bias, and all taps at the base value
+  for (int k = x->row[q]; k < x->row[q + 1]; k++) keraxpy(J, x->val[k], lz->wc + x->col[k] * lz->S, o); // the rest of the taps
+  ebp->fv[0](J, o); // see eq 7, LIR p 6
+  for (int l = 1; l < ebp->L; l++) feed(ebp, l);
+}
+
+static void backsparse(Ebp* ebp, Lazy* lz, const Spm* x, int q, const double* t, int s) {
+  /* Propagate the errors against the target pattern t of the sparse pattern q, the cycle's pattern s, backward.
+   * The momentum rule decays every del-weight after every pattern, but the first layer's columns of base taps only decay,
+   * so a column catches up on its decay, alpha to the power of the patterns it missed, when a pattern next uses it; see lazystore(). */
+  for (int l = ebp->L - 1; l > 0; l--) propagate(ebp, l, t);
+  deltas(ebp, 0, t);
+  const int J = ebp->N[0];
+  const double* d = ebp->d[0];
+  for (int k = x->row[q]; k < x->row[q + 1]; k++) {
+    const int i = x->col[k];
+    keraxpby(J, ebp->eta * x->val[k], d, lz->ap[s + 1 - lz->at[i]], lz->sc + i * lz->S); // see eq 16, LIR p 9
+    lz->at[i] = s + 1;
+  }
+  keraxpby(J, ebp->eta, d, ebp->alpha, lz->sc + ebp->I * lz->S); // bias
+  if (x->base != 0.0) keraxpby(J, ebp->eta * x->base, d, ebp->alpha, lz->r); // every tap's base value
+}
+
+void learnsparse(Ebp* ebp, const Spm* x, double** tt) {
+  /* Train the network on input patterns stored sparse, one pattern at a time on the calling thread; see learn().
+   * The weights and del-weights are the same as those of dense training, up to rounding. */
+  if (ebp->watch == NULL) printf("learn %s (sparse input, %d of %ld taps)\n", ebp->name, x->row[x->R], (long) x->R * x->C);
+  if (ebp->dw == NULL || ebp->mode == HOGWILD || ebp->opt == LM || ebp->opt == LBFGS) {
+    fprintf(stderr, "ERROR: network %s cannot learn from sparse input patterns\n", ebp->name);
+    exit(1);
+  }
+  if (ebp->mode != SYNC || ebp->T > 1 || ebp->B > 1) {
+    fprintf(stderr, "ERROR: network %s cannot learn from sparse input patterns in batches, on threads, or in pipeline mode; it presents one pattern at a time\n", ebp->name);
+    exit(1);
+  }
+  const int lo = ebp->L - 1;
+  const double t0 = now();
+  Lazy* lz = lazynew(ebp);
+  lazyload(ebp, lz, x->base);
+  int c = 0;
+  for (bool go = true, pruning = ebp->prune > 0.0; go && (pruning || ebp->e > ebp->epsilon) && c < ebp->C; c++) {
+    // learn one cycle
+    pace(ebp, NULL, c);
+    if (ebp->shuffle) shuffle(ebp->P, ebp->order);
+    ebp->e = 0.0;
+    for (int s = 0; s < ebp->P; s++) {
+      const int q = ebp->order[s];
+      feedsparse(ebp, lz, x, q);
+      backsparse(ebp, lz, x, q, tt[q], s);
       for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(ebp->d[lo][j]); // sum of squares error; see LIR p 4
     }
     // update weights at end of cycle
-    for (int l = 0; l < ebp->L; l++)
-      for (int j = 0; j < ebp->N[l]; j++) {
-        const int I = l == 0 ? ebp->I : ebp->N[l - 1];
-        for (int i = 0; i <= I; i++) ebp->w[l][j][i] += ebp->dw[l][j][i]; // (w) = (w) + (dw)
-      }
+    lazystore(ebp, lz, ebp->P);
+    update(ebp);
+    pruning = thin(ebp, c);
+    lazyload(ebp, lz, x->base);
     // report training error
     ebp->e = sqrt(ebp->e) / ebp->N[lo] / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
-    if (ebp->e < ebp->epsilon || c % (ebp->C / 10) == 0) report(ebp, c);
+    go = watch(ebp, c);
   }
+  lazydel(lz);
+  finish(ebp, c, now() - t0);
+}
+
+void recallsparse(Ebp* ebp, const Spm* x, double** tt) {
+  /* Test the network on input patterns stored sparse; report only the recall error, for the patterns may have too many taps to show. */
+  printf("recall %s\n", ebp->name);
+  const int lo = ebp->L - 1;
+  Lazy* lz = lazynew(ebp);
+  lazyload(ebp, lz, x->base);
+  ebp->e = 0.0;
+  for (int p = 0; p < x->R; p++) {
+    feedsparse(ebp, lz, x, p);
+    for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(tt[p][j] - ebp->o[lo][j]);
+  }
+  lazydel(lz);
+  ebp->e = sqrt(ebp->e) / ebp->N[lo] / x->R;
+  report(ebp, -1);
 }
 
 void recall(Ebp* ebp, int P, double** ii, double** tt) {
@@ -228,4 +1624,187 @@ void recall(Ebp* ebp, int P, double** ii, double** tt) {
   // report recall error
   ebp->e = sqrt(ebp->e) / ebp->N[lo] / P;
   report(ebp, -1);
-}
\ No newline at end of file
+}
+
+/* model file
+ * The header holds the topology and the activation names; the weights follow it, one block per layer in the padded layout of rows().
+ * offset  size          field
+ *  0      8             magic "LIRMODEL"
+ *  8      4             version
+ * 12      4             byte order mark 0x01020304, in the byte order of the writer
+ * 16      4             L
+ * 20      4             I
+ * 24      8             offset of the first weight block; a multiple of ALIGN
+ * 32      FLDSIZ        network name, NUL padded
+ * ..      4 * L         N[l]
+ * ..      ACTSIZ * L    act[l], NUL padded
+ * Every weight block is N[l] rows of kerpad(I + 1) doubles, so every block and every row starts on a cache line, as it does in memory. */
+
+#define MAGIC "LIRMODEL"
+#define VERSION 1
+#define BOM 0x01020304
+#define ACTSIZ 32 // activation name field size (in bytes)
+
+static size_t weightoffset(int L) {
+  /* Offset of the first weight block in a model file of L layers. */
+  const size_t h = 32 + FLDSIZ + L * (sizeof(int32_t) + ACTSIZ);
+  return (h + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+void ebpsave(const Ebp* ebp, const char* file) {
+  /* Save the network's topology and weights into the model file, by way of a temporary file.
+   * ebpload() and the scoring server map the model file, so it is replaced whole by rename(), rather than rewritten under them. */
+  char tmp[FLDSIZ + 4];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  FILE* fo = fopen(tmp, "w");
+  if (fo == NULL) {
+    fprintf(stderr, "ERROR: cannot save model file %s\n", tmp);
+    exit(1);
+  }
+  const uint32_t hd[2] = {VERSION, BOM};
+  const int32_t li[2] = {ebp->L, ebp->I};
+  const uint64_t woff = weightoffset(ebp->L);
+  char fld[FLDSIZ] = {0};
+  strncpy(fld, ebp->name, FLDSIZ - 1);
+  fwrite(MAGIC, 1, 8, fo);
+  fwrite(hd, sizeof(uint32_t), 2, fo);
+  fwrite(li, sizeof(int32_t), 2, fo);
+  fwrite(&woff, sizeof(uint64_t), 1, fo);
+  fwrite(fld, 1, FLDSIZ, fo);
+  for (int l = 0; l < ebp->L; l++) {
+    const int32_t n = ebp->N[l];
+    fwrite(&n, sizeof(int32_t), 1, fo);
+  }
+  for (int l = 0; l < ebp->L; l++) {
+    char a[ACTSIZ] = {0};
+    strncpy(a, ebp->act[l], ACTSIZ - 1);
+    fwrite(a, 1, ACTSIZ, fo);
+  }
+  for (long z = ftell(fo); z < (long) woff; z++) fputc(0, fo);
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    fwrite(ebp->w[l][0], sizeof(double), (size_t) ebp->N[l] * kerpad(I + 1), fo); // whole block, padding included
+  }
+  if (fflush(fo) != 0 || fsync(fileno(fo)) != 0 || ferror(fo) || fclose(fo) != 0 || rename(tmp, file) != 0) {
+    fprintf(stderr, "ERROR: cannot save model file %s\n", file);
+    exit(1);
+  }
+}
+
+static void badmodel(const char* file, const char* why) {
+  fprintf(stderr, "ERROR: cannot load model file %s: %s\n", file, why);
+  exit(1);
+}
+
+Ebp* ebpload(const char* file) {
+  /* Load a network saved by ebpsave() for inference: map the model file into memory, and use its weights in place, without copying them.
+   * Processes that load the same file share its pages. The network has no del-weights, so it cannot learn().
+   * The layers of a pruned network that are sparse enough run on CSR copies of their weights instead; see sparsify(). */
+  const int fd = open(file, O_RDONLY);
+  if (fd < 0) badmodel(file, "cannot open");
+  struct stat st;
+  if (fstat(fd, &st) != 0) badmodel(file, "cannot stat");
+  const size_t z = st.st_size;
+  if (z < weightoffset(0)) badmodel(file, "truncated header");
+  char* map = mmap(NULL, z, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the map holds its own reference to the file
+  if (map == MAP_FAILED) badmodel(file, "cannot map");
+  uint32_t hd[2];
+  int32_t li[2];
+  uint64_t woff;
+  memcpy(hd, map + 8, sizeof(hd));
+  memcpy(li, map + 16, sizeof(li));
+  memcpy(&woff, map + 24, sizeof(woff));
+  if (memcmp(map, MAGIC, 8) != 0) badmodel(file, "not a model file");
+  if (hd[0] != VERSION) badmodel(file, "unknown version");
+  if (hd[1] != BOM) badmodel(file, "foreign byte order");
+  if (li[0] < 1 || li[1] < 1 || woff != weightoffset(li[0]) || z < woff) badmodel(file, "bad topology");
+  Ebp* ebp = calloc(1, sizeof(Ebp)); // no training state
+  ebp->map = map;
+  ebp->mapsize = z;
+  ebp->name = strndup(map + 32, FLDSIZ);  // malloc()
+  ebp->e = DBL_MAX;
+  ebp->B = 1;
+  ebp->T = 1;
+  ebp->mode = SYNC;
+  ebp->L = li[0];
+  ebp->I = li[1];
+  ebp->N = malloc(ebp->L * sizeof(int));
+  ebp->act = malloc(ebp->L * sizeof(char*));
+  ebp->f = malloc(ebp->L * sizeof(Act));
+  ebp->df = malloc(ebp->L * sizeof(Act));
+  ebp->fv = malloc(ebp->L * sizeof(Actv));
+  ebp->dfv = malloc(ebp->L * sizeof(Dactv));
+  ebp->w = malloc(ebp->L * sizeof(double**));
+  ebp->wt = calloc(ebp->L, sizeof(double**)); // no transposes
+  const char* h = map + 32 + FLDSIZ;
+  size_t off = woff;
+  for (int l = 0; l < ebp->L; l++) {
+    int32_t n;
+    memcpy(&n, h + l * sizeof(int32_t), sizeof(n));
+    if (n < 1) badmodel(file, "bad topology");
+    ebp->N[l] = n;
+    ebp->act[l] = strndup(h + ebp->L * sizeof(int32_t) + l * ACTSIZ, ACTSIZ - 1); // malloc()
+    const ActPair p = actpair(ebp->act[l]);
+    ebp->f[l] = p.f;
+    ebp->df[l] = p.df;
+    const ActPairv v = actpairv(ebp->act[l], false);
+    ebp->fv[l] = v.f;
+    ebp->dfv[l] = v.df;
+    const int S = kerpad((l == 0 ? ebp->I : ebp->N[l - 1]) + 1); // row stride
+    if (off + (size_t) n * S * sizeof(double) > z) badmodel(file, "truncated weights");
+    ebp->w[l] = malloc(n * sizeof(double*));
+    for (int j = 0; j < n; j++) ebp->w[l][j] = (double*) (map + off) + j * S;
+    off += (size_t) n * S * sizeof(double);
+  }
+  buffers(ebp);
+  sparsify(ebp); // a pruned network runs on its sparse weights, and leaves the pages of its dense ones alone
+  return ebp;
+}
+
+/* inference */
+
+#define PB 32 // patterns per block in predict(); keeps a block of every layer's outputs in L2
+
+size_t predictsize(const Ebp* ebp) {
+  /* Number of doubles of scratch space that predict() needs, whatever the number of patterns. */
+  size_t z = (size_t) PB * kerpad(ebp->I + 1);
+  for (int l = 0; l < ebp->L; l++) z += (size_t) PB * kerpad(ebp->N[l] + 1);
+  return z;
+}
+
+void predict(const Ebp* ebp, int P, const double* x, double* y, double* scratch) {
+  /* Feed P patterns forward, a block of PB at a time, one matrix-matrix product per layer.
+   * Reads the network but writes only y and scratch, so threads with their own scratch may predict with one network at once.
+   * x: P input patterns of I taps, one per row
+   * y: P output vectors of N[L-1] activations, one per row
+   * scratch: predictsize() doubles */
+  const int lo = ebp->L - 1;
+  const int K = ebp->N[lo];
+  for (int p0 = 0; p0 < P; p0 += PB) {
+    const int B = P - p0 < PB ? P - p0 : PB;
+    double* in = scratch; // augmented input matrix, one pattern per row
+    int I = ebp->I;
+    for (int b = 0; b < B; b++) {
+      memcpy(in + b * kerpad(I + 1), x + (size_t) (p0 + b) * I, I * sizeof(double));
+      in[b * kerpad(I + 1) + I] = 1.0; // bias node output
+    }
+    for (int l = 0; l < ebp->L; l++) { // from the first layer to the last
+      const int J = ebp->N[l];
+      const int S = kerpad(J + 1);
+      double* o = in + PB * kerpad(I + 1);
+      if (ebp->sw != NULL && ebp->sw[l] != NULL) {
+        const Spm* sw = ebp->sw[l];
+        for (int b = 0; b < B; b++)
+          for (int j = 0; j < J; j++) o[b * S + j] = kerdoti(sw->row[j + 1] - sw->row[j], sw->val + sw->row[j], sw->col + sw->row[j], in + b * kerpad(I + 1)); // pruned weights add nothing
+      } else kergemmnt(B, J, I + 1, 1.0, in, kerpad(I + 1), ebp->w[l][0], kerpad(I + 1), 0.0, o, S); // (net) = (i) * (w)'
+      for (int b = 0; b < B; b++) {
+        ebp->fv[l](J, o + b * S); // see eq 7, LIR p 6
+        o[b * S + J] = 1.0; // bias node output
+      }
+      in = o;
+      I = J;
+    }
+    for (int b = 0; b < B; b++) memcpy(y + (size_t) (p0 + b) * K, in + b * kerpad(K + 1), K * sizeof(double));
+  }
+}
@@ -4,7 +4,34 @@
 #ifndef NN_LIR_H
 #define NN_LIR_H
 
+#include <stddef.h>
 #include "etc.h"
+#include "thr.h"
+#include "stm.h"
+#include "spm.h"
+#include "ckp.h"
+
+typedef enum Mode {
+  SYNC, // synchronous: the weights are updated at the end of each cycle
+  HOGWILD, // asynchronous: each worker updates the shared weights after each pattern, without locks
+  PIPELINE, // synchronous: each worker owns a contiguous range of layers, and patterns flow between workers through queues
+} Mode;
+
+typedef enum Optimizer {
+  MOMENTUM, // fixed learning rate and momentum factor; see eq 16, LIR p 9
+  RMSPROP, // per-weight learning rate divided by a running RMS of the cycle's gradient; see Tieleman (2012)
+  ADAM, // per-weight learning rate from bias-corrected running moments of the cycle's gradient; see Kingma (2015)
+  RPROP, // per-weight step size adapted to the sign changes of the cycle's gradient; see iRprop-, Igel (2000)
+  LM, // second order, full batch: Levenberg-Marquardt on the patterns' Jacobian; see Hagan (1994); falls back to LBFGS for many weights
+  LBFGS, // second order, full batch: limited-memory BFGS with a backtracking line search; see Liu (1989)
+} Optimizer;
+
+typedef enum Schedule {
+  CONSTANT, // the learning rate stays eta
+  STEP, // the learning rate decays by the decay factor every period cycles
+  COSINE, // the learning rate anneals from eta to 0 along half a cosine over the C cycles; see Loshchilov (2017)
+  PLATEAU, // the learning rate decays by the decay factor after period cycles without improvement of the error
+} Schedule;
 
 typedef struct Ebp {
   char* name; // network name
@@ -16,23 +43,69 @@ typedef struct Ebp {
   int P; // number of data patterns
   bool shuffle; // shuffle input patterns
   int* order; // input pattern presentation order
+  int B; // batch size; number of patterns fed through the network at once
+  int T; // number of worker threads
+  Pool* pool; // worker thread pool; NULL when T = 1 and mode is SYNC
+  Mode mode; // weight update mode
+  bool sparse; // present the input patterns by their non-zero taps (HOGWILD only)
+  bool exact; // the logistic activations call the libm exp(), instead of kerexp()
+  const int* nz; // non-zero taps of the current input pattern, then the bias tap, then -1; NULL for dense input
+  struct Ebp** wk; // worker networks wk[t], which share w and wt with this network; NULL without pool
   int L; // number of layers
   int I; // number of input taps
   int* N; // number of nodes N[l]
+  char** act; // name of activation function act[l]
   Act* f; // activation function f[l]
   Act* df; // derivative of activation function df[l]
+  Actv* fv; // whole-layer activation function fv[l]
+  Dactv* dfv; // whole-layer derivative of activation function dfv[l]
   double* p; // augmented input pattern
   double** i; // augmented input vector i[l][j]; pointers i[l] -> o[l-1]
   double** o; // augmented output vector o[l][j]
   double** d; // delta vector d[l][j]
   double*** w; // augmented weight matrix w[l][j][i]
-  double*** dw; // augmented del-weight matrix dw[l][j][i]
+  double*** dw; // augmented del-weight matrix dw[l][j][i]; NULL when loaded by ebpload()
+  double*** wt; // transposed weight matrix wt[l][i][j], without bias row; wt[0] is unused
+  double** ib; // batch input matrix ib[l][b * kerpad(I + 1) + i]; pointers ib[l] -> ob[l-1]; NULL when B = 1
+  double** ob; // batch output matrix ob[l][b * kerpad(J + 1) + j], one augmented o[l] per row
+  double** db; // batch delta matrix db[l][b * kerpad(J) + j], one d[l] per row
+  void* map; // memory-mapped model file in which w lies; NULL when the weights were allocated by ebpnew()
+  size_t mapsize; // size of map (in bytes)
+  Optimizer opt; // weight update rule
+  Schedule sched; // learning rate schedule
+  double lr; // configured learning rate; eta and alpha are 1.0 under an adaptive optimizer, so dw sums the cycle's gradient
+  double rate; // scheduled learning rate of the current cycle
+  double decay; // learning rate decay factor (STEP, PLATEAU)
+  int period; // number of cycles per decay (STEP), or without improvement before a decay (PLATEAU)
+  double best; // lowest error so far (PLATEAU)
+  int stall; // number of cycles since the error was lowest (PLATEAU)
+  long k; // number of adaptive updates so far (ADAM)
+  double*** m; // first moment m[l][j][i] of the gradient (ADAM), or the previous cycle's gradient (RPROP); NULL under MOMENTUM
+  double*** v; // second moment v[l][j][i] of the gradient (RMSPROP, ADAM), or the step size (RPROP); NULL under MOMENTUM
+  double prune; // target fraction of each layer's weights pruned, the bias weights aside; 0.0 for none
+  Spm** sw; // pruned weight matrix sw[l] in CSR, which forward() and backward() run on; sw[l] is NULL for a layer run dense, and sw is NULL for an unpruned network
+  Watch watch; // watches the training after every cycle, instead of report(); NULL reports to stdout
+  void* watcher; // watch's argument
+  Ckp* ckp; // periodic checkpoints of the training state; NULL for none
+  int c0; // first training cycle; past 0 when resumed from a checkpoint by ebpresume()
 } Ebp;
 
-extern Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int C, int P, bool shuffle, int L, int I, const int* N, char** act);
+extern Ebp* ebpnew(const char* name, double eta, double alpha, double epsilon, int C, int P, bool shuffle, int B, int T, Mode mode, bool sparse, bool exact, int L, int I, const int* N, char** act);
 extern void ebpdel(Ebp* ebp);
+extern void ebpopt(Ebp* ebp, Optimizer opt, Schedule sched, double decay, int period);
+extern void ebpresume(Ebp* ebp, Ckp* ck);
 extern void learn(Ebp* ebp, double** ii, double** tt);
+extern void learnstream(Ebp* ebp, Stream* st);
 extern void recall(Ebp* ebp, int P, double** ii, double** tt);
+extern void recallstream(Ebp* ebp, Stream* st);
+extern void learnsparse(Ebp* ebp, const Spm* x, double** tt);
+extern void recallsparse(Ebp* ebp, const Spm* x, double** tt);
+extern void ebpprune(Ebp* ebp, double sparsity);
+extern void gauge(Ebp* ebp, int P, double** ii);
 extern void dump(const Ebp* ebp);
+extern void ebpsave(const Ebp* ebp, const char* file);
+extern Ebp* ebpload(const char* file);
+extern size_t predictsize(const Ebp* ebp);
+extern void predict(const Ebp* ebp, int P, const double* x, double* y, double* scratch);
 
 #endif // NN_LIR_H
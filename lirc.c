@@ -0,0 +1,103 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Model compiler: emit a standalone C source file that computes the forward pass of one trained network.
+ * The layer widths are compile-time constants, the weights are static const arrays, and the activation functions are inlined,
+ * so the C compiler can unroll and vectorise the loops of a small network, and no indirect calls remain. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "csv.h"
+#include "ker.h"
+#include "lirc.h"
+
+static const char* body(const char* act) {
+  /* C expression of the activation function named act, of the net input x; see etc.c. */
+  if (strcmp(act, "linear") == 0) return "x";
+  else if (strcmp(act, "relu") == 0) return "x > 0.0 ? x : 0.01";
+  else if (strcmp(act, "logisticb") == 0) return "2.0 / (1.0 + exp(-x)) - 1.0";
+  else if (strcmp(act, "logisticu") == 0) return "1.0 / (1.0 + exp(-x))";
+  else if (strcmp(act, "stepb") == 0) return "x < 0.0 ? -0.99 : (x > 0.0 ? 0.99 : 0.0)";
+  else if (strcmp(act, "stepu") == 0) return "x < 0.0 ? 0.01 : (x > 0.0 ? 0.99 : 0.0)";
+  fprintf(stderr, "ERROR: unknown activation function\n");
+  exit(1);
+}
+
+static FILE* create(const char* file) {
+  /* Open the file for a generated source. */
+  FILE* fo = fopen(file, "w");
+  if (fo == NULL) {
+    fprintf(stderr, "ERROR: cannot save C file %s\n", file);
+    exit(1);
+  }
+  return fo;
+}
+
+static void finish(FILE* fo, const char* file) {
+  /* Close the file of a generated source. */
+  if (ferror(fo) || fclose(fo) != 0) {
+    fprintf(stderr, "ERROR: cannot save C file %s\n", file);
+    exit(1);
+  }
+}
+
+void ebpcompile(const Ebp* ebp, const char* cfile, const char* hfile) {
+  /* Emit into cfile the C function void "name"(const double* x, double* y), which feeds the input pattern x forward into the output vector y,
+   * and into hfile its prototype and the sizes of x and y.
+   * The function's name is the network's name with every character that is not allowed in a C identifier replaced by _, and nn_ before a leading digit;
+   * the generated macros are prefixed with it in upper case, so that the sources of several networks, and the user's code, can be built together. */
+  char id[FLDSIZ]; // C identifier
+  char uc[FLDSIZ]; // upper case prefix for the macros
+  int n = 0;
+  if (!isalpha((unsigned char) ebp->name[0]) && ebp->name[0] != '_') n = sprintf(id, "nn_");
+  for (const char* c = ebp->name; *c != '\0' && n < FLDSIZ - 1; c++, n++) id[n] = isalnum((unsigned char) *c) ? *c : '_';
+  id[n] = '\0';
+  for (int k = 0; k <= n; k++) uc[k] = (char) toupper((unsigned char) id[k]);
+  const int lo = ebp->L - 1;
+  // header
+  FILE* fo = create(hfile);
+  fprintf(fo, "/* Forward pass of the trained network %s; generated by lirc, do not edit. */\n\n", ebp->name);
+  fprintf(fo, "#ifndef %s_H\n#define %s_H\n\n", uc, uc);
+  fprintf(fo, "#define %s_I %d // number of input taps\n", uc, ebp->I);
+  fprintf(fo, "#define %s_O %d // number of outputs\n\n", uc, ebp->N[lo]);
+  fprintf(fo, "extern void %s(const double* x, double* y);\n\n", id);
+  fprintf(fo, "#endif // %s_H\n", uc);
+  finish(fo, hfile);
+  // source
+  const char* base = strrchr(hfile, '/'); // the source includes the header from its own directory
+  base = base == NULL ? hfile : base + 1;
+  fo = create(cfile);
+  fprintf(fo, "/* Forward pass of the trained network %s; generated by lirc, do not edit. */\n\n", ebp->name);
+  fprintf(fo, "#include <math.h>\n#include \"%s\"\n\n", base);
+  // layer widths, weights, and activation functions
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    fprintf(fo, "#define %s_I%d %d\n", uc, l, I);
+    fprintf(fo, "#define %s_N%d %d\n\n", uc, l, ebp->N[l]);
+    fprintf(fo, "static const double w%d[%s_N%d][%s_I%d + 1] __attribute__((aligned(%d))) = { // augmented weight matrix; the bias weight is last\n", l, uc, l, uc, l, ALIGN);
+    for (int j = 0; j < ebp->N[l]; j++) {
+      fprintf(fo, "    {");
+      for (int i = 0; i <= I; i++) fprintf(fo, "%s%.17g", i == 0 ? "" : ", ", ebp->w[l][j][i]); // round trips exactly
+      fprintf(fo, "},\n");
+    }
+    fprintf(fo, "};\n\n");
+    fprintf(fo, "static inline double f%d(double x) { // %s\n  return %s;\n}\n\n", l, ebp->act[l], body(ebp->act[l]));
+  }
+  // forward pass
+  fprintf(fo, "void %s(const double* x, double* y) {\n", id);
+  for (int l = 0; l < ebp->L; l++) {
+    const bool last = l == lo;
+    if (!last) fprintf(fo, "  double o%d[%s_N%d];\n", l, uc, l);
+    fprintf(fo, "  for (int j = 0; j < %s_N%d; j++) {\n", uc, l);
+    fprintf(fo, "    double net = w%d[j][%s_I%d];\n", l, uc, l);
+    fprintf(fo, "    for (int i = 0; i < %s_I%d; i++) net += w%d[j][i] * ", uc, l, l);
+    if (l == 0) fprintf(fo, "x[i];\n");
+    else fprintf(fo, "o%d[i];\n", l - 1);
+    if (last) fprintf(fo, "    y[j] = f%d(net);\n", l);
+    else fprintf(fo, "    o%d[j] = f%d(net);\n", l, l);
+    fprintf(fo, "  }\n");
+  }
+  fprintf(fo, "}\n");
+  finish(fo, cfile);
+}
@@ -0,0 +1,11 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_LIRC_H
+#define NN_LIRC_H
+
+#include "lir.h"
+
+extern void ebpcompile(const Ebp* ebp, const char* cfile, const char* hfile);
+
+#endif // NN_LIRC_H
@@ -0,0 +1,29 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Compile the network saved in dat/"netname".ebp by ./lir -s netname into the C source file dat/"netname".c and its header dat/"netname".h. */
+
+#include <stdlib.h>
+#include <libc.h>
+#include "csv.h"
+#include "lir.h"
+#include "lirc.h"
+
+int main(int argc, const char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s netname\n", argv[0]);
+    exit(1);
+  }
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.ebp", cwd, argv[1]);
+  Ebp* ebp = ebpload(buf);
+  char hf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.c", cwd, argv[1]);
+  sprintf(hf, "%s/dat/%s.h", cwd, argv[1]);
+  ebpcompile(ebp, buf, hf);
+  printf("compile %s %s\n", buf, hf);
+  ebpdel(ebp);
+  ebp = NULL;
+  return 0;
+}
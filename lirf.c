@@ -0,0 +1,225 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Single-precision back-propagation; see lir.c for the double-precision original.
+ * Floats halve the memory traffic of the weights and double the SIMD width, at a precision far beyond the usual error criteria.
+ * Only the RMS error, a sum over every output of every pattern, is accumulated in double precision.
+ * References:
+ * LIR: Learning Internal Representations by Error Propagation, Rumelhart (1986)
+ * ANS: Introduction to Artificial Neural Systems, Zurada (1992) */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include "csv.h"
+#include "etc.h"
+#include "ker.h"
+#include "lirf.h"
+
+void dumpf(const Ebpf* ebp) {
+  /* Dump the current weights. */
+  printf("dump %s weights\n", ebp->name);
+  for (int l = 0; l < ebp->L; l++) {
+    printf("l = %d\n", l);
+    for (int j = 0; j < ebp->N[l]; j++) {
+      printf("  j = %d ", j);
+      const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+      for (int i = 0; i <= I; i++) printf("| %+10.4f ", ebp->w[l][j][i]);
+      printf("|\n");
+    }
+  }
+}
+
+static inline void report(const Ebpf* ebp, int c) {
+  /* Report the current training cycle and current training error. */
+  printf("c = %-10d  e = %-10.8f\n", c, ebp->e);
+}
+
+/* back-propagation */
+
+static float** rows(int R, int C) {
+  /* Allocate R rows of C floats as one contiguous, aligned block, each row padded to whole cache lines. */
+  const int S = kerpadf(C); // row stride
+  float* b = kerallocf(R * S);
+  float** a = malloc(R * sizeof(float*));
+  for (int r = 0; r < R; r++) a[r] = b + r * S;
+  return a;
+}
+
+static void unrows(float** a) {
+  /* Free the rows allocated by rows(). */
+  free(a[0]);
+  free(a);
+}
+
+static void transpose(Ebpf* ebp, int l) {
+  /* Refresh the transposed copy of layer l's weights. */
+  if (l == 0) return;
+  const int J = ebp->N[l];
+  const int I = ebp->N[l - 1];
+  for (int j = 0; j < J; j++)
+    for (int i = 0; i < I; i++) ebp->wt[l][i][j] = ebp->w[l][j][i];
+}
+
+Ebpf* ebpfnew(const char* name, double eta, double alpha, double epsilon, int nC, int nP, bool shuffle, int nL, int nI, const int* nN, char** act) {
+  /* Create a network; see ebpnew(). */
+  Ebpf* ebp = malloc(sizeof(Ebpf));
+  ebp->name = strndup(name, FLDSIZ);  // malloc()
+  ebp->eta = (float) eta;
+  ebp->alpha = (float) alpha;
+  ebp->epsilon = epsilon;
+  ebp->e = DBL_MAX;
+  ebp->C = nC;
+  ebp->P = nP;
+  ebp->shuffle = shuffle;
+  ebp->order = malloc(ebp->P * sizeof(int));
+  for (int p = 0; p < ebp->P; p++) ebp->order[p] = p;
+  ebp->L = nL;
+  ebp->I = nI;
+  ebp->N = malloc(ebp->L * sizeof(int));
+  ebp->f = malloc(ebp->L * sizeof(Actf));
+  ebp->df = malloc(ebp->L * sizeof(Actf));
+  ebp->p = kerallocf(ebp->I + 1); // +1 augmentation for bias node; see fn 1, LIR p 9
+  ebp->p[ebp->I] = 1.0f;  // bias node output
+  ebp->i = malloc(ebp->L * sizeof(float*));
+  ebp->o = malloc(ebp->L * sizeof(float*));
+  ebp->d = malloc(ebp->L * sizeof(float*));
+  ebp->w = malloc(ebp->L * sizeof(float**));
+  ebp->dw = malloc(ebp->L * sizeof(float**));
+  ebp->wt = malloc(ebp->L * sizeof(float**));
+  for (int l = 0; l < ebp->L; l++) {
+    const int J = nN[l];
+    const int I = l == 0 ? ebp->I : nN[l - 1];
+    ebp->N[l] = J;
+    const ActPairf p = actpairf(act[l]);
+    ebp->f[l] = p.f;
+    ebp->df[l] = p.df;
+    ebp->i[l] = l == 0 ? ebp->p : ebp->o[l - 1];  // point to upstream layer's augmented output vector
+    ebp->o[l] = kerallocf(J + 1);
+    ebp->o[l][J] = 1.0f;  // bias node output
+    ebp->d[l] = kerallocf(J);
+    ebp->w[l] = rows(J, I + 1);
+    ebp->dw[l] = rows(J, I + 1); // zeroed
+    ebp->wt[l] = l == 0 ? NULL : rows(I, J);
+    for (int j = 0; j < J; j++)
+      for (int i = 0; i <= I; i++) ebp->w[l][j][i] = (float) randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
+    transpose(ebp, l);
+  }
+  return ebp;
+}
+
+void ebpfdel(Ebpf* ebp) {
+  /* Destroy the network. */
+  for (int l = 0; l < ebp->L; l++) {
+    if (ebp->wt[l] != NULL) unrows(ebp->wt[l]);
+    unrows(ebp->dw[l]);
+    unrows(ebp->w[l]);
+    free(ebp->d[l]);
+    free(ebp->o[l]);
+  }
+  free(ebp->wt);
+  ebp->wt = NULL;
+  free(ebp->dw);
+  ebp->dw = NULL;
+  free(ebp->w);
+  ebp->w = NULL;
+  free(ebp->d);
+  ebp->d = NULL;
+  free(ebp->o);
+  ebp->o = NULL;
+  free(ebp->i);
+  ebp->i = NULL;
+  free(ebp->p);
+  ebp->p = NULL;
+  free(ebp->df);
+  ebp->df = NULL;
+  free(ebp->f);
+  ebp->f = NULL;
+  free(ebp->N);
+  ebp->N = NULL;
+  free(ebp->order);
+  ebp->order = NULL;
+  free(ebp->name);
+  ebp->name = NULL;
+  free(ebp);
+}
+
+static void forward(Ebpf* ebp, const float* p) {
+  /* Feed the pattern p forward. */
+  memcpy(ebp->p, p, ebp->I * sizeof(float)); // network [p] = input [p]; does not overwrite bias node
+  for (int l = 0; l < ebp->L; l++) { // from the first layer to the last
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    for (int j = 0; j < ebp->N[l]; j++) ebp->o[l][j] = ebp->f[l](kerdotf(I + 1, ebp->w[l][j], ebp->i[l])); // see eq 7, LIR p 6
+  }
+}
+
+static void backward(Ebpf* ebp, const float* p) {
+  /* Propagate the errors against the target pattern p backward. */
+  const int lo = ebp->L - 1;
+  for (int l = lo; l >= 0; l--) { // from the last layer to the first
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    if (l == lo) // for output nodes
+      for (int j = 0; j < J; j++) ebp->d[l][j] = (p[j] - ebp->o[l][j]) * ebp->df[l](ebp->o[l][j]); // see eq 13, LIR p 7
+    else // for hidden nodes
+      for (int j = 0; j < J; j++) ebp->d[l][j] = kerdotf(ebp->N[l + 1], ebp->wt[l + 1][j], ebp->d[l + 1]) * ebp->df[l](ebp->o[l][j]); // see eq 14, LIR p 7
+    for (int j = 0; j < J; j++) keraxpbyf(I + 1, ebp->eta * ebp->d[l][j], ebp->i[l], ebp->alpha, ebp->dw[l][j]); // see eq 16, LIR p 9
+  }
+}
+
+void learnf(Ebpf* ebp, float** ii, float** tt) {
+  /* Train the network.
+   * ii[]: input patterns
+   * tt[]: associated target patterns (to calculate recall errors) */
+  printf("learn %s (single precision)\n", ebp->name);
+  const int lo = ebp->L - 1;
+  for (int c = 0; ebp->e > ebp->epsilon && c < ebp->C; c++) {
+    // learn one cycle
+    if (ebp->shuffle) shuffle(ebp->P, ebp->order);
+    ebp->e = 0.0;
+    for (int p = 0; p < ebp->P; p++) {
+      forward(ebp, ii[ebp->order[p]]);
+      backward(ebp, tt[ebp->order[p]]);
+      for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(ebp->d[lo][j]); // sum of squares error; see LIR p 4
+    }
+    // update weights at end of cycle
+    for (int l = 0; l < ebp->L; l++) {
+      const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+      keraxpyf(ebp->N[l] * kerpadf(I + 1), 1.0f, ebp->dw[l][0], ebp->w[l][0]); // (w) = (w) + (dw)
+      transpose(ebp, l);
+    }
+    // report training error
+    ebp->e = sqrt(ebp->e) / ebp->N[lo] / ebp->P; // root-mean-square error; see eq 4.35, ANS p 196
+    if (ebp->e < ebp->epsilon || c % (ebp->C / 10) == 0) report(ebp, c);
+  }
+}
+
+void recallf(Ebpf* ebp, int P, float** ii, float** tt) {
+  /* Test the network.
+   * P: number of data patterns
+   * ii[]: input patterns
+   * tt[]: associated target patterns (to calculate recall errors) */
+  printf("recall %s\n", ebp->name);
+  const int lo = ebp->L - 1;
+  ebp->e = 0.0;
+  for (int p = 0; p < P; p++) {
+    // feed a test pattern
+    const float* i = ii[p];
+    const float* t = tt[p];
+    forward(ebp, i);
+    for (int j = 0; j < ebp->N[lo]; j++) ebp->e += sqre(t[j] - ebp->o[lo][j]);
+    // show input-output associations
+    printf("p = %-10d\n", p);
+    printf("  i = ");
+    for (int j = 0; j < ebp->I; j++) printf("| %+10.4f ", i[j]);
+    printf("|\n  o = ");
+    for (int j = 0; j < ebp->N[lo]; j++) printf("| %+10.4f ", ebp->o[lo][j]);
+    printf("|\n  t = ");
+    for (int j = 0; j < ebp->N[lo]; j++) printf("| %+10.4f ", t[j]);
+    printf("|\n");
+  }
+  // report recall error
+  ebp->e = sqrt(ebp->e) / ebp->N[lo] / P;
+  report(ebp, -1);
+}
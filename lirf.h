@@ -0,0 +1,39 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_LIRF_H
+#define NN_LIRF_H
+
+#include "etc.h"
+
+typedef struct Ebpf { // single-precision counterpart of Ebp
+  char* name; // network name
+  float eta; // learning rate
+  float alpha; // momentum factor
+  double epsilon; // error criterion
+  double e; // current cycle's error; accumulated in double precision
+  int C; // number of training cycles
+  int P; // number of data patterns
+  bool shuffle; // shuffle input patterns
+  int* order; // input pattern presentation order
+  int L; // number of layers
+  int I; // number of input taps
+  int* N; // number of nodes N[l]
+  Actf* f; // activation function f[l]
+  Actf* df; // derivative of activation function df[l]
+  float* p; // augmented input pattern
+  float** i; // augmented input vector i[l][j]; pointers i[l] -> o[l-1]
+  float** o; // augmented output vector o[l][j]
+  float** d; // delta vector d[l][j]
+  float*** w; // augmented weight matrix w[l][j][i]
+  float*** dw; // augmented del-weight matrix dw[l][j][i]
+  float*** wt; // transposed weight matrix wt[l][i][j], without bias row; wt[0] is unused
+} Ebpf;
+
+extern Ebpf* ebpfnew(const char* name, double eta, double alpha, double epsilon, int C, int P, bool shuffle, int L, int I, const int* N, char** act);
+extern void ebpfdel(Ebpf* ebp);
+extern void learnf(Ebpf* ebp, float** ii, float** tt);
+extern void recallf(Ebpf* ebp, int P, float** ii, float** tt);
+extern void dumpf(const Ebpf* ebp);
+
+#endif // NN_LIRF_H
@@ -6,9 +6,15 @@
 
 #include <time.h>
 #include <stdlib.h>
+#include <float.h>
 #include <libc.h>
 #include "csv.h"
 #include "lir.h"
+#include "ckp.h"
+#include "lirf.h"
+#include "lirq.h"
+#include "lirv.h"
+#include "swp.h"
 
 static double** load(int P, const char* file) {
   Csv* csv = csvnew(file);
@@ -28,7 +34,82 @@ static void toss(int P, double** pp) {
   free(pp);
 }
 
-static void run(const char* name) {
+static float** narrow(int P, int F, double** pp) {
+  /* Convert the patterns to single precision. */
+  float** ff = malloc(P * sizeof(float*));
+  for (int p = 0; p < P; p++) {
+    ff[p] = malloc(F * sizeof(float));
+    for (int j = 0; j < F; j++) ff[p][j] = (float) pp[p][j];
+  }
+  return ff;
+}
+
+static void tossf(int P, float** ff) {
+  for (int p = 0; p < P; p++) free(ff[p]);
+  free(ff);
+}
+
+static void keep(const Ebp* ebp, const char* cwd, const char* name, double* best) {
+  /* Save the network into dat/"name".ebp, if saving is on and its recall error is below *best. */
+  if (best == NULL || ebp->e >= *best) return;
+  *best = ebp->e;
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.ebp", cwd, name);
+  ebpsave(ebp, buf);
+  printf("save %s\n", buf);
+}
+
+static Mode mode(const char* m) {
+  if (m == NULL || strcmp(m, "sync") == 0) return SYNC;
+  else if (strcmp(m, "hogwild") == 0) return HOGWILD;
+  else if (strcmp(m, "pipeline") == 0) return PIPELINE;
+  fprintf(stderr, "ERROR: unknown weight update mode %s\n", m);
+  exit(1);
+}
+
+static bool precision(const char* p) {
+  /* Check if the network trains in single precision. */
+  if (p == NULL || strcmp(p, "double") == 0) return false;
+  else if (strcmp(p, "single") == 0) return true;
+  fprintf(stderr, "ERROR: unknown precision %s\n", p);
+  exit(1);
+}
+
+static Optimizer optimizer(const char* o) {
+  if (o == NULL || strcmp(o, "momentum") == 0) return MOMENTUM;
+  else if (strcmp(o, "rmsprop") == 0) return RMSPROP;
+  else if (strcmp(o, "adam") == 0) return ADAM;
+  else if (strcmp(o, "rprop") == 0) return RPROP;
+  else if (strcmp(o, "lm") == 0) return LM;
+  else if (strcmp(o, "lbfgs") == 0) return LBFGS;
+  fprintf(stderr, "ERROR: unknown optimizer %s\n", o);
+  exit(1);
+}
+
+static Schedule schedule(const char* s) {
+  if (s == NULL || strcmp(s, "constant") == 0) return CONSTANT;
+  else if (strcmp(s, "step") == 0) return STEP;
+  else if (strcmp(s, "cosine") == 0) return COSINE;
+  else if (strcmp(s, "plateau") == 0) return PLATEAU;
+  fprintf(stderr, "ERROR: unknown learning rate schedule %s\n", s);
+  exit(1);
+}
+
+static void spread(const char* s, int V, double* x) {
+  /* Parse the per-lane values field formatted as "a|b..." into x[v]; the last value fills the remaining lanes. */
+  char buf[FLDSIZ];
+  strcpy(buf, s);
+  int v = 0;
+  char* z; // strtok_r() state
+  for (char* t, * u = buf; v < V && (t = strtok_r(u, "|\n\r", &z)) != NULL; u = NULL) x[v++] = atof(t);
+  for (; v < V; v++) x[v] = x[v - 1];
+}
+
+static void run(const char* name, double* best, Trial* tr, int t, bool resume) {
+  /* Train the network described by dat/"name".csv; when best is not NULL, save the network into dat/"name".ebp if its recall error is below *best.
+   * t: trial number, stored in the checkpoints of dat/"name".ckp
+   * resume: resume the training from dat/"name".ckp
+   * tr: sweep trial whose values override the configuration, and which watches the training quietly; NULL for a standalone run */
   // initialize
   char cwd[FLDSIZ];
   getcwd(cwd, sizeof(cwd)); // current working directory
@@ -36,6 +117,7 @@ static void run(const char* name) {
   sprintf(buf, "%s/dat/%s.csv", cwd, name); // ~cwd/dat/"name".csv
   Csv* cfgcsv = csvnew(buf);
   csvload(cfgcsv);
+  if (tr != NULL) sweepapply(tr, cfgcsv);
   int f = 1; // CSV field; start at 1 to skip network name field
   int C = atoi(cfgcsv->r[1][f++]); // cfgcsv->r[1] holds data, r[0] holds header
   int L = atoi(cfgcsv->r[1][f++]);
@@ -44,48 +126,294 @@ static void run(const char* name) {
   int N[L * sizeof(int)];
   strcpy(buf, cfgcsv->r[1][f++]);
   int l = 0;
-  for (char* t, * s = buf; (t = strtok(s, "|\n\r")) != NULL; s = NULL) N[l++] = atoi(t);
+  char* z; // strtok_r() state; concurrent trials parse their configurations at once
+  for (char* t, * s = buf; (t = strtok_r(s, "|\n\r", &z)) != NULL; s = NULL) N[l++] = atoi(t);
   // parse activation function per layer field formatted as "f|g..."
   strcpy(buf, cfgcsv->r[1][f++]);
   l = 0;
   char* act[L * sizeof(Act)];
-  for (char* t, * s = buf; (t = strtok(s, "|\n\r")) != NULL; s = NULL) act[l++] = strndup(t, FLDSIZ); // malloc()
+  for (char* t, * s = buf; (t = strtok_r(s, "|\n\r", &z)) != NULL; s = NULL) act[l++] = strndup(t, FLDSIZ); // malloc()
+  const char* etas = cfgcsv->r[1][f]; // per-lane values, for lanes below
   double eta = atof(cfgcsv->r[1][f++]);
+  const char* alphas = cfgcsv->r[1][f];
   double alpha = atof(cfgcsv->r[1][f++]);
   double epsilon = atof(cfgcsv->r[1][f++]);
   int P = atoi(cfgcsv->r[1][f++]);
   bool shuffle = istrue(cfgcsv->r[1][f++]);
+  const char* s = csvget(cfgcsv, 1, "B"); // optional column
+  int B = s == NULL ? 1 : atoi(s);
+  s = csvget(cfgcsv, 1, "T");
+  int T = s == NULL ? 1 : atoi(s);
+  Mode m = mode(csvget(cfgcsv, 1, "mode"));
+  s = csvget(cfgcsv, 1, "sparse");
+  bool sparse = s != NULL && istrue(s);
+  bool guess = s != NULL && strcmp(s, "auto") == 0; // store the input patterns sparse if they are sparse enough
+  s = csvget(cfgcsv, 1, "exact");
+  bool exact = s != NULL && istrue(s);
+  bool single = precision(csvget(cfgcsv, 1, "precision"));
+  s = csvget(cfgcsv, 1, "quantize");
+  bool quantize = s != NULL && istrue(s);
+  s = csvget(cfgcsv, 1, "chunk");
+  int Q = s == NULL ? 0 : atoi(s);
+  Optimizer o = optimizer(csvget(cfgcsv, 1, "optimizer"));
+  Schedule r = schedule(csvget(cfgcsv, 1, "schedule"));
+  bool tuned = o != MOMENTUM || r != CONSTANT; // the optimizer or the learning rate schedule is set
+  s = csvget(cfgcsv, 1, "decay");
+  tuned = tuned || s != NULL;
+  double decay = s == NULL ? 0.5 : atof(s);
+  s = csvget(cfgcsv, 1, "period");
+  tuned = tuned || s != NULL;
+  int period = s == NULL ? C / 10 : atoi(s);
+  s = csvget(cfgcsv, 1, "checkpoint");
+  int every = s == NULL ? 0 : atoi(s); // number of cycles between checkpoints
+  s = csvget(cfgcsv, 1, "prune");
+  double prune = s == NULL ? 0.0 : atof(s);
+  s = csvget(cfgcsv, 1, "lanes");
+  int V = s == NULL ? 0 : atoi(s);
+  double etav[V > 0 ? V : 1];
+  double alphav[V > 0 ? V : 1];
+  if (V > 0) {
+    spread(etas, V, etav);
+    spread(alphas, V, alphav);
+  }
   csvdel(cfgcsv);
   cfgcsv = NULL;
+  if (tr != NULL && (Q > 0 || single || V > 0)) {
+    fprintf(stderr, "ERROR: network %s cannot be swept; a sweep trains in memory, in double precision, one network at a time\n", name);
+    exit(1);
+  }
+  if ((every > 0 || resume) && (tr != NULL || Q > 0 || single || V > 0 || m == HOGWILD || o == LM || o == LBFGS)) {
+    fprintf(stderr, "ERROR: network %s cannot be checkpointed; only learn() in sync or pipeline mode with a first-order optimizer checkpoints\n", name);
+    exit(1);
+  }
+  if ((single || V > 0) && (tuned || prune > 0.0 || best != NULL)) {
+    fprintf(stderr, "ERROR: network %s cannot take an optimizer, a schedule, pruning, or saving in %s; only the momentum rule trains it\n", name, V > 0 ? "lanes" : "single precision");
+    exit(1);
+  }
+  if ((single || V > 0) && (B > 1 || T > 1 || m != SYNC || sparse || Q > 0 || quantize)) {
+    fprintf(stderr, "ERROR: network %s cannot take B, T, mode, sparse, chunk, or quantize in %s; it presents one pattern at a time on one thread\n", name, V > 0 ? "lanes" : "single precision");
+    exit(1);
+  }
+  if (single && V > 0) {
+    fprintf(stderr, "ERROR: network %s cannot train lanes in single precision\n", name);
+    exit(1);
+  }
+  if (Q > 0 && quantize) {
+    fprintf(stderr, "ERROR: network %s cannot be quantized from streamed patterns; quantization calibrates on the patterns in memory\n", name);
+    exit(1);
+  }
+  if (V > 0 && exact) {
+    fprintf(stderr, "ERROR: network %s cannot compute exact activations in lanes\n", name);
+    exit(1);
+  }
+  if (every > 0) rngseed((unsigned int) random()); // a sequence of the thread's own, whose state a checkpoint can hold
+  if (prune < 0.0 || prune >= 1.0) {
+    fprintf(stderr, "ERROR: network %s cannot prune a fraction %g of its weights\n", name, prune);
+    exit(1);
+  }
+  if (Q > 0) { // stream pattern vectors from their files, instead of loading them
+    char tf[FLDSIZ];
+    sprintf(buf, "%s/dat/%s-i.csv", cwd, name);
+    sprintf(tf, "%s/dat/%s-t.csv", cwd, name);
+    Ebp* ebp = ebpnew(name, eta, alpha, epsilon, C, P, shuffle, B, T, m, sparse, exact, L, I, N, act);
+    ebpopt(ebp, o, r, decay, period);
+    ebp->prune = prune;
+    Stream* st = stmnew(buf, tf, P, I, N[L - 1], Q, shuffle);
+    learnstream(ebp, st);
+    dump(ebp);
+    recallstream(ebp, st);
+    keep(ebp, cwd, name, best);
+    ebpdel(ebp);
+    ebp = NULL;
+    stmdel(st);
+    st = NULL;
+    return;
+  }
   // load pattern vectors
   sprintf(buf, "%s/dat/%s-i.csv", cwd, name);
-  double** ii = load(P, buf);
+  Spm* x = NULL; // input patterns stored sparse
+  double** ii = NULL;
+  if (spmfile(buf)) {
+    if (m == HOGWILD || V > 0 || single) {
+      fprintf(stderr, "ERROR: network %s cannot learn from sparse input patterns\n", name);
+      exit(1);
+    }
+    if (quantize) {
+      fprintf(stderr, "ERROR: network %s cannot be quantized from sparse input patterns; quantization calibrates on the dense patterns\n", name);
+      exit(1);
+    }
+    x = spmload(buf, P, I);
+  } else ii = load(P, buf);
+  if (ii != NULL && m != HOGWILD && V == 0 && !single && (sparse || (guess && B == 1 && T == 1 && m == SYNC))) { // learnsparse() presents one pattern at a time
+    double density;
+    const double base = spmbase(P, I, ii, &density);
+    if (sparse || density <= DENSITY) x = spmnew(P, I, ii, base);
+  }
+  if ((every > 0 || resume) && x != NULL) {
+    fprintf(stderr, "ERROR: network %s cannot be checkpointed; only learn() in sync or pipeline mode with a first-order optimizer checkpoints\n", name);
+    exit(1);
+  }
   sprintf(buf, "%s/dat/%s-t.csv", cwd, name);
   double** tt = load(P, buf);
   // train network
-  Ebp* ebp = ebpnew(name, eta, alpha, epsilon, C, P, shuffle, L, I, N, act);
-  learn(ebp, ii, tt);
-  dump(ebp);
-  recall(ebp, P, ii, tt);
-  ebpdel(ebp);
-  ebp = NULL;
+  if (V > 0) {
+    Ebpv* ev = ebpvnew(name, etav, alphav, epsilon, C, P, shuffle, V, L, I, N, act);
+    learnv(ev, ii, tt);
+    recallv(ev, P, ii, tt);
+    ebpvdel(ev);
+    ev = NULL;
+  } else if (single) {
+    float** fi = narrow(P, I, ii);
+    float** ft = narrow(P, N[L - 1], tt);
+    Ebpf* ebp = ebpfnew(name, eta, alpha, epsilon, C, P, shuffle, L, I, N, act);
+    learnf(ebp, fi, ft);
+    dumpf(ebp);
+    recallf(ebp, P, fi, ft);
+    ebpfdel(ebp);
+    ebp = NULL;
+    tossf(P, ft);
+    tossf(P, fi);
+  } else {
+    Ebp* ebp = ebpnew(name, eta, alpha, epsilon, C, P, shuffle, B, T, m, sparse, exact, L, I, N, act);
+    ebpopt(ebp, o, r, decay, period);
+    ebp->prune = prune;
+    if (tr != NULL) { // report only to the sweep
+      ebp->watch = sweepwatch;
+      ebp->watcher = tr;
+      if (x != NULL) learnsparse(ebp, x, tt);
+      else learn(ebp, ii, tt);
+    } else if (x != NULL) {
+      learnsparse(ebp, x, tt);
+      dump(ebp);
+      recallsparse(ebp, x, tt);
+      keep(ebp, cwd, name, best);
+    } else {
+      sprintf(buf, "%s/dat/%s.ckp", cwd, name);
+      if (resume) {
+        Ckp* ck = ckpopen(buf);
+        ebpresume(ebp, ck);
+        ckpdel(ck);
+        ck = NULL;
+        printf("resume %s at cycle %d\n", name, ebp->c0);
+      }
+      if (every > 0) ebp->ckp = ckpnew(buf, every, t);
+      learn(ebp, ii, tt);
+      if (ebp->ckp != NULL) { // the trial is done, so a restart need not resume it
+        ckpdel(ebp->ckp);
+        ebp->ckp = NULL;
+        remove(buf);
+      }
+      dump(ebp);
+      recall(ebp, P, ii, tt);
+      keep(ebp, cwd, name, best);
+      if (prune > 0.0) gauge(ebp, P, ii);
+    }
+    if (quantize && ii != NULL && tr == NULL) {
+      Ebpq* ebq = ebpqnew(ebp);
+      calibrate(ebq, ebp, P, ii, tt);
+      ebpqdel(ebq);
+      ebq = NULL;
+    }
+    ebpdel(ebp);
+    ebp = NULL;
+  }
   // terminate
+  if (x != NULL) spmdel(x);
+  x = NULL;
+  toss(P, tt);
+  tt = NULL;
+  if (ii != NULL) toss(P, ii);
+  ii = NULL;
+}
+
+static void trial(const char* name, Trial* tr) {
+  /* Run one trial of a sweep; see Run. */
+  run(name, NULL, tr, 0, false);
+}
+
+static void sweep(const char* name) {
+  /* Sweep the network over the grid in dat/"name"-sweep.csv, and save the trials' summaries into dat/"name"-trials.csv. */
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s-sweep.csv", cwd, name);
+  Sweep* sw = sweepnew(name, buf, trial);
+  sprintf(buf, "%s/dat/%s-trials.csv", cwd, name);
+  sweeprun(sw, buf);
+  sweepdel(sw);
+  sw = NULL;
+}
+
+static void score(const char* name) {
+  /* Recall the patterns of dat/"name".csv with the network saved in dat/"name".ebp, without training. */
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.csv", cwd, name);
+  Csv* cfgcsv = csvnew(buf);
+  csvload(cfgcsv);
+  int P = atoi(csvget(cfgcsv, 1, "P"));
+  csvdel(cfgcsv);
+  cfgcsv = NULL;
+  sprintf(buf, "%s/dat/%s.ebp", cwd, name);
+  Ebp* ebp = ebpload(buf);
+  sprintf(buf, "%s/dat/%s-i.csv", cwd, name);
+  double** ii = load(P, buf);
+  sprintf(buf, "%s/dat/%s-t.csv", cwd, name);
+  double** tt = load(P, buf);
+  recall(ebp, P, ii, tt);
+  if (ebp->sw != NULL) gauge(ebp, P, ii); // the saved network was pruned
   toss(P, tt);
   tt = NULL;
   toss(P, ii);
   ii = NULL;
+  ebpdel(ebp);
+  ebp = NULL;
+}
+
+static int checkpointed(const char* name) {
+  /* Return the trial number stored in dat/"name".ckp. */
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.ckp", cwd, name);
+  Ckp* ck = ckpopen(buf);
+  if (ck == NULL) {
+    fprintf(stderr, "ERROR: cannot resume network %s without checkpoint file %s\n", name, buf);
+    exit(1);
+  }
+  const int t = ck->tag;
+  ckpdel(ck);
+  ck = NULL;
+  return t;
 }
 
 int main(int argc, const char** argv) {
   srandom(time(NULL));
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s netname\n", argv[0]);
+  const bool save = argc == 3 && strcmp(argv[1], "-s") == 0; // save the best trial's network
+  const bool saved = argc == 3 && strcmp(argv[1], "-l") == 0; // recall with the saved network instead of training
+  const bool grid = argc == 3 && strcmp(argv[1], "-w") == 0; // sweep the hyperparameters instead of running the trials
+  const bool resume = argc == 3 && strcmp(argv[1], "--resume") == 0; // resume the trials from the checkpoint
+  if (argc != 2 && !save && !saved && !grid && !resume) {
+    fprintf(stderr, "Usage: %s [-s | -l | -w | --resume] netname\n", argv[0]);
     exit(1);
   }
+  const char* name = argv[argc - 1];
+  if (saved) {
+    score(name);
+    return 0;
+  }
+  if (grid) {
+    sweep(name);
+    return 0;
+  }
   const int T = 3; // number of trials
-  for (int t = 0; t < T; t++) {
+  int t0 = 0; // first trial
+  if (resume) t0 = checkpointed(name);
+  double best = DBL_MAX;
+  for (int t = t0; t < T; t++) {
     printf("\n---- t = %d ----\n", t);
-    run(argv[1]);
+    run(name, save ? &best : NULL, NULL, t, resume && t == t0);
   }
   return 0;
 }
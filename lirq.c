@@ -0,0 +1,189 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Post-training quantization of a trained Ebp network into an inference-only network of 8-bit weights.
+ * Each row of weights w[l][j] is scaled by its own largest magnitude onto [-127, +127], and each layer's input vector by a scale found by calibrate().
+ * The net input is then an integer dot product, accumulated in 32 bits, that is scaled back to a real number before the activation function.
+ * The bias weights stay real, so that the quantization of the inputs does not shift every node's threshold. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "csv.h"
+#include "etc.h"
+#include "ker.h"
+#include "lirq.h"
+
+#define QMAX 127 // largest magnitude of a quantized value; symmetric range, so -128 is never used
+
+static int8_t** rowsq(int R, int C) {
+  /* Allocate R rows of C 8-bit integers as one contiguous, aligned block, each row padded to whole cache lines. */
+  const int S = kerpadq(C); // row stride
+  int8_t* b = kerallocq(R * S);
+  int8_t** a = malloc(R * sizeof(int8_t*));
+  for (int r = 0; r < R; r++) a[r] = b + r * S;
+  return a;
+}
+
+static void unrowsq(int8_t** a) {
+  /* Free the rows allocated by rowsq(). */
+  free(a[0]);
+  free(a);
+}
+
+static inline int8_t quantize(double v, double s) {
+  /* Round v / s to the nearest quantized value. */
+  const double q = round(v / s);
+  return (int8_t) (q > QMAX ? QMAX : q < -QMAX ? -QMAX : q);
+}
+
+static inline double absmax(int n, const double* x) {
+  /* Largest magnitude of x[]. */
+  double m = 0.0;
+  for (int i = 0; i < n; i++) m = fmax(m, fabs(x[i]));
+  return m;
+}
+
+Ebpq* ebpqnew(const Ebp* ebp) {
+  /* Quantize the trained network ebp. */
+  Ebpq* ebq = malloc(sizeof(Ebpq));
+  ebq->name = strndup(ebp->name, FLDSIZ);  // malloc()
+  ebq->L = ebp->L;
+  ebq->I = ebp->I;
+  ebq->N = malloc(ebq->L * sizeof(int));
+  ebq->f = malloc(ebq->L * sizeof(Actv));
+  ebq->q = malloc(ebq->L * sizeof(int8_t**));
+  ebq->s = malloc(ebq->L * sizeof(float*));
+  ebq->b = malloc(ebq->L * sizeof(float*));
+  ebq->x = malloc(ebq->L * sizeof(float));
+  ebq->iq = malloc(ebq->L * sizeof(int8_t*));
+  ebq->o = malloc(ebq->L * sizeof(double*));
+  ebq->r = malloc(ebq->L * sizeof(double*));
+  for (int l = 0; l < ebq->L; l++) {
+    const int J = ebp->N[l];
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    ebq->N[l] = J;
+    ebq->f[l] = ebp->fv[l];
+    ebq->q[l] = rowsq(J, I);
+    ebq->s[l] = malloc(J * sizeof(float));
+    ebq->b[l] = malloc(J * sizeof(float));
+    for (int j = 0; j < J; j++) {
+      const double m = absmax(I, ebp->w[l][j]);
+      ebq->s[l][j] = (float) (m > 0.0 ? m / QMAX : 1.0);
+      for (int i = 0; i < I; i++) ebq->q[l][j][i] = quantize(ebp->w[l][j][i], ebq->s[l][j]);
+      ebq->b[l][j] = (float) ebp->w[l][j][I];
+    }
+    ebq->x[l] = 1.0f / QMAX; // inputs in [-1, +1] until calibrated
+    ebq->iq[l] = kerallocq(I);
+    ebq->o[l] = keralloc(J);
+    ebq->r[l] = keralloc(J);
+  }
+  return ebq;
+}
+
+void ebpqdel(Ebpq* ebq) {
+  /* Destroy the network. */
+  for (int l = 0; l < ebq->L; l++) {
+    free(ebq->r[l]);
+    free(ebq->o[l]);
+    free(ebq->iq[l]);
+    free(ebq->b[l]);
+    free(ebq->s[l]);
+    unrowsq(ebq->q[l]);
+  }
+  free(ebq->r);
+  ebq->r = NULL;
+  free(ebq->o);
+  ebq->o = NULL;
+  free(ebq->iq);
+  ebq->iq = NULL;
+  free(ebq->x);
+  ebq->x = NULL;
+  free(ebq->b);
+  ebq->b = NULL;
+  free(ebq->s);
+  ebq->s = NULL;
+  free(ebq->q);
+  ebq->q = NULL;
+  free(ebq->f);
+  ebq->f = NULL;
+  free(ebq->N);
+  ebq->N = NULL;
+  free(ebq->name);
+  ebq->name = NULL;
+  free(ebq);
+}
+
+size_t ebpqsize(const Ebpq* ebq) {
+  /* Number of bytes of parameters: quantized weights, row scales, bias weights, and input scales; excludes the row padding. */
+  size_t z = ebq->L * sizeof(float);
+  for (int l = 0; l < ebq->L; l++) {
+    const int I = l == 0 ? ebq->I : ebq->N[l - 1];
+    z += (size_t) ebq->N[l] * (I * sizeof(int8_t) + 2 * sizeof(float));
+  }
+  return z;
+}
+
+const double* inferq(Ebpq* ebq, const double* p) {
+  /* Feed the pattern p forward, and return the output vector. */
+  const double* in = p;
+  for (int l = 0; l < ebq->L; l++) {
+    const int I = l == 0 ? ebq->I : ebq->N[l - 1];
+    for (int i = 0; i < I; i++) ebq->iq[l][i] = quantize(in[i], ebq->x[l]);
+    for (int j = 0; j < ebq->N[l]; j++) {
+      const int32_t d = kerdotq(I, ebq->q[l][j], ebq->iq[l]);
+      ebq->o[l][j] = (double) ebq->s[l][j] * ebq->x[l] * d + ebq->b[l][j]; // dequantized net input
+    }
+    ebq->f[l](ebq->N[l], ebq->o[l]); // see eq 7, LIR p 6
+    in = ebq->o[l];
+  }
+  return ebq->o[ebq->L - 1];
+}
+
+static const double* reference(Ebpq* ebq, const Ebp* ebp, const double* p) {
+  /* Feed the pattern p forward through the double-precision weights of ebp into r[], and return the output vector. */
+  const double* in = p;
+  for (int l = 0; l < ebp->L; l++) {
+    const int I = l == 0 ? ebp->I : ebp->N[l - 1];
+    for (int j = 0; j < ebp->N[l]; j++) ebq->r[l][j] = kerdot(I, ebp->w[l][j], in) + ebp->w[l][j][I];
+    ebp->fv[l](ebp->N[l], ebq->r[l]);
+    in = ebq->r[l];
+  }
+  return ebq->r[ebp->L - 1];
+}
+
+void calibrate(Ebpq* ebq, const Ebp* ebp, int P, double** ii, double** tt) {
+  /* Set the input scales from the ranges of the layers' inputs over the patterns, and report the loss of accuracy against ebp.
+   * ebp: trained network from which ebq was quantized
+   * P: number of data patterns
+   * ii[]: input patterns
+   * tt[]: associated target patterns (to calculate recall errors) */
+  printf("calibrate %s\n", ebq->name);
+  const int lo = ebq->L - 1;
+  // find the range of each layer's input vector
+  double m[ebq->L];
+  for (int l = 0; l < ebq->L; l++) m[l] = 0.0;
+  for (int p = 0; p < P; p++) {
+    reference(ebq, ebp, ii[p]);
+    m[0] = fmax(m[0], absmax(ebq->I, ii[p]));
+    for (int l = 1; l < ebq->L; l++) m[l] = fmax(m[l], absmax(ebq->N[l - 1], ebq->r[l - 1]));
+  }
+  for (int l = 0; l < ebq->L; l++) ebq->x[l] = (float) (m[l] > 0.0 ? m[l] / QMAX : 1.0);
+  // compare the quantized outputs with the double-precision outputs
+  double e = 0.0, eq = 0.0, dmax = 0.0;
+  for (int p = 0; p < P; p++) {
+    const double* r = reference(ebq, ebp, ii[p]);
+    const double* o = inferq(ebq, ii[p]);
+    for (int j = 0; j < ebq->N[lo]; j++) {
+      e += sqre(tt[p][j] - r[j]);
+      eq += sqre(tt[p][j] - o[j]);
+      dmax = fmax(dmax, fabs(r[j] - o[j]));
+    }
+  }
+  e = sqrt(e) / ebq->N[lo] / P; // root-mean-square error, as in recall()
+  eq = sqrt(eq) / ebq->N[lo] / P;
+  size_t z = 0;
+  for (int l = 0; l < ebp->L; l++) z += (size_t) ebp->N[l] * ((l == 0 ? ebp->I : ebp->N[l - 1]) + 1) * sizeof(double);
+  printf("  e = %-10.8f (double)  e = %-10.8f (int8)  max |o - r| = %-10.8f\n", e, eq, dmax);
+  printf("  %zu bytes (double)  %zu bytes (int8)  %.2fx smaller\n", z, ebpqsize(ebq), (double) z / ebpqsize(ebq));
+}
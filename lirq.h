@@ -0,0 +1,33 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_LIRQ_H
+#define NN_LIRQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "etc.h"
+#include "lir.h"
+
+typedef struct Ebpq { // inference-only, 8-bit quantized counterpart of a trained Ebp
+  char* name; // network name
+  int L; // number of layers
+  int I; // number of input taps
+  int* N; // number of nodes N[l]
+  Actv* f; // whole-layer activation function f[l]
+  int8_t*** q; // quantized weight matrix q[l][j][i], without bias column; w[l][j][i] ~ s[l][j] * q[l][j][i]
+  float** s; // weight scale s[l][j] of each row
+  float** b; // bias weight b[l][j], kept at full range
+  float* x; // input scale x[l]; i[l][i] ~ x[l] * iq[l][i], set by calibrate()
+  int8_t** iq; // quantized input vector iq[l][i]
+  double** o; // output vector o[l][j]
+  double** r; // double-precision reference output vector r[l][j], used by calibrate()
+} Ebpq;
+
+extern Ebpq* ebpqnew(const Ebp* ebp);
+extern void ebpqdel(Ebpq* ebq);
+extern size_t ebpqsize(const Ebpq* ebq);
+extern void calibrate(Ebpq* ebq, const Ebp* ebp, int P, double** ii, double** tt);
+extern const double* inferq(Ebpq* ebq, const double* p);
+
+#endif // NN_LIRQ_H
@@ -0,0 +1,280 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Lane-batched back-propagation: V independent networks of one topology, each with its own initial weights, learning rate, momentum factor, and pattern order,
+ * stored as a structure of arrays, so that every weight, output, and delta is a vector of V lanes.
+ * A tiny network, like the XOR network, is far too narrow to fill a SIMD register, but V copies of it are exactly as wide as the register, or two or four of them.
+ * The lanes learn in lockstep; each lane retires on its own when it meets the error criterion, and its weights stay as they were. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include "csv.h"
+#include "etc.h"
+#include "ker.h"
+#include "lirv.h"
+
+Ebpv* ebpvnew(const char* name, const double* eta, const double* alpha, double epsilon, int nC, int nP, bool shuffle, int nV, int nL, int nI, const int* nN, char** act) {
+  /* Create V networks; see ebpnew().
+   * eta[], alpha[]: learning rate and momentum factor per lane
+   * nV: number of lanes; 4, 8, or 16 */
+  if (nV != 4 && nV != 8 && nV != 16) {
+    fprintf(stderr, "ERROR: %d lanes; must be 4, 8, or 16\n", nV);
+    exit(1);
+  }
+  Ebpv* ev = malloc(sizeof(Ebpv));
+  ev->name = strndup(name, FLDSIZ);  // malloc()
+  const int V = ev->V = nV;
+  ev->eta = malloc(V * sizeof(double));
+  ev->alpha = malloc(V * sizeof(double));
+  ev->e = malloc(V * sizeof(double));
+  ev->c = malloc(V * sizeof(int));
+  ev->live = keralloc(V);
+  ev->seed = malloc(V * sizeof(unsigned int));
+  for (int v = 0; v < V; v++) {
+    ev->eta[v] = eta[v];
+    ev->alpha[v] = alpha[v];
+    ev->e[v] = DBL_MAX;
+    ev->c[v] = 0;
+    ev->live[v] = 1.0;
+    ev->seed[v] = (unsigned int) rnd();
+  }
+  ev->epsilon = epsilon;
+  ev->C = nC;
+  ev->P = nP;
+  ev->shuffle = shuffle;
+  ev->order = malloc(V * ev->P * sizeof(int));
+  for (int v = 0; v < V; v++)
+    for (int p = 0; p < ev->P; p++) ev->order[v * ev->P + p] = p;
+  ev->L = nL;
+  ev->I = nI;
+  ev->N = malloc(ev->L * sizeof(int));
+  ev->f = malloc(ev->L * sizeof(Actv));
+  ev->df = malloc(ev->L * sizeof(Dactv));
+  ev->p = keralloc((ev->I + 1) * V); // +1 augmentation for bias node; see fn 1, LIR p 9
+  for (int v = 0; v < V; v++) ev->p[ev->I * V + v] = 1.0; // bias node output
+  ev->i = malloc(ev->L * sizeof(double*));
+  ev->o = malloc(ev->L * sizeof(double*));
+  ev->d = malloc(ev->L * sizeof(double*));
+  ev->w = malloc(ev->L * sizeof(double*));
+  ev->dw = malloc(ev->L * sizeof(double*));
+  for (int l = 0; l < ev->L; l++) {
+    const int J = nN[l];
+    const int I = l == 0 ? ev->I : nN[l - 1];
+    ev->N[l] = J;
+    const ActPairv a = actpairv(act[l], false);
+    ev->f[l] = a.f;
+    ev->df[l] = a.df;
+    ev->i[l] = l == 0 ? ev->p : ev->o[l - 1];  // point to upstream layer's augmented output vector
+    ev->o[l] = keralloc((J + 1) * V);
+    for (int v = 0; v < V; v++) ev->o[l][J * V + v] = 1.0; // bias node output
+    ev->d[l] = keralloc(J * V);
+    ev->w[l] = keralloc(J * (I + 1) * V);
+    ev->dw[l] = keralloc(J * (I + 1) * V); // zeroed
+    for (int v = 0; v < V; v++) // lane by lane, each lane a network of its own
+      for (int k = 0; k < J * (I + 1); k++) ev->w[l][k * V + v] = randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
+  }
+  return ev;
+}
+
+void ebpvdel(Ebpv* ev) {
+  /* Destroy the networks. */
+  for (int l = 0; l < ev->L; l++) {
+    free(ev->dw[l]);
+    free(ev->w[l]);
+    free(ev->d[l]);
+    free(ev->o[l]);
+  }
+  free(ev->dw);
+  ev->dw = NULL;
+  free(ev->w);
+  ev->w = NULL;
+  free(ev->d);
+  ev->d = NULL;
+  free(ev->o);
+  ev->o = NULL;
+  free(ev->i);
+  ev->i = NULL;
+  free(ev->p);
+  ev->p = NULL;
+  free(ev->df);
+  ev->df = NULL;
+  free(ev->f);
+  ev->f = NULL;
+  free(ev->N);
+  ev->N = NULL;
+  free(ev->order);
+  ev->order = NULL;
+  free(ev->seed);
+  ev->seed = NULL;
+  free(ev->live);
+  ev->live = NULL;
+  free(ev->c);
+  ev->c = NULL;
+  free(ev->e);
+  ev->e = NULL;
+  free(ev->alpha);
+  ev->alpha = NULL;
+  free(ev->eta);
+  ev->eta = NULL;
+  free(ev->name);
+  ev->name = NULL;
+  free(ev);
+}
+
+/* The lane count V is a constant in each of the functions below once they are inlined into present4(), present8(), and present16(),
+ * so the compiler turns every loop over the lanes into a few SIMD instructions. */
+
+static inline void forwardv(Ebpv* ev, double** ii, int p, const int V) {
+  /* Feed pattern p of each lane's order forward through all lanes. */
+  for (int v = 0; v < V; v++) {
+    const double* x = ii[ev->order[v * ev->P + p]];
+    for (int i = 0; i < ev->I; i++) ev->p[i * V + v] = x[i]; // does not overwrite bias node
+  }
+  for (int l = 0; l < ev->L; l++) { // from the first layer to the last
+    const int J = ev->N[l];
+    const int I = l == 0 ? ev->I : ev->N[l - 1];
+    const double* in = ev->i[l];
+    for (int j = 0; j < J; j++) {
+      const double* w = ev->w[l] + j * (I + 1) * V;
+      double net[V];
+      for (int v = 0; v < V; v++) net[v] = 0.0;
+      for (int i = 0; i <= I; i++)
+        for (int v = 0; v < V; v++) net[v] += w[i * V + v] * in[i * V + v];
+      for (int v = 0; v < V; v++) ev->o[l][j * V + v] = net[v];
+    }
+    ev->f[l](J * V, ev->o[l]); // see eq 7, LIR p 6
+  }
+}
+
+static inline void backwardv(Ebpv* ev, double** tt, int p, const int V) {
+  /* Propagate the errors against target pattern p of each lane's order backward through all lanes. */
+  const int lo = ev->L - 1;
+  for (int l = lo; l >= 0; l--) { // from the last layer to the first
+    const int J = ev->N[l];
+    const int I = l == 0 ? ev->I : ev->N[l - 1];
+    double* d = ev->d[l];
+    // calculate deltas
+    if (l == lo) { // for output nodes
+      for (int v = 0; v < V; v++) {
+        const double* t = tt[ev->order[v * ev->P + p]];
+        for (int j = 0; j < J; j++) d[j * V + v] = t[j] - ev->o[l][j * V + v];
+      }
+      ev->df[l](J * V, ev->o[l], d); // see eq 13, LIR p 7
+    } else { // for hidden nodes
+      const int K = ev->N[l + 1];
+      const double* dd = ev->d[l + 1];
+      for (int j = 0; j < J; j++) {
+        double err[V];
+        for (int v = 0; v < V; v++) err[v] = 0.0;
+        for (int k = 0; k < K; k++) {
+          const double* w = ev->w[l + 1] + (k * (J + 1) + j) * V; // weight from node j to downstream node k
+          for (int v = 0; v < V; v++) err[v] += w[v] * dd[k * V + v];
+        }
+        for (int v = 0; v < V; v++) d[j * V + v] = err[v];
+      }
+      ev->df[l](J * V, ev->o[l], d); // see eq 14, LIR p 7
+    }
+    // calculate del-weights
+    const double* in = ev->i[l];
+    for (int j = 0; j < J; j++) {
+      double ed[V];
+      for (int v = 0; v < V; v++) ed[v] = ev->eta[v] * d[j * V + v];
+      double* dw = ev->dw[l] + j * (I + 1) * V;
+      for (int i = 0; i <= I; i++)
+        for (int v = 0; v < V; v++) dw[i * V + v] = ed[v] * in[i * V + v] + ev->alpha[v] * dw[i * V + v]; // see eq 16, LIR p 9
+    }
+  }
+  // accumulate errors
+  for (int j = 0; j < ev->N[lo]; j++)
+    for (int v = 0; v < V; v++) ev->e[v] += ev->live[v] * ev->d[lo][j * V + v] * ev->d[lo][j * V + v]; // sum of squares error of the live lanes; see LIR p 4
+}
+
+static inline void presentv(Ebpv* ev, double** ii, double** tt, const int V) {
+  for (int p = 0; p < ev->P; p++) {
+    forwardv(ev, ii, p, V);
+    backwardv(ev, tt, p, V);
+  }
+}
+
+static void present4(Ebpv* ev, double** ii, double** tt) {
+  presentv(ev, ii, tt, 4);
+}
+
+static void present8(Ebpv* ev, double** ii, double** tt) {
+  presentv(ev, ii, tt, 8);
+}
+
+static void present16(Ebpv* ev, double** ii, double** tt) {
+  presentv(ev, ii, tt, 16);
+}
+
+void learnv(Ebpv* ev, double** ii, double** tt) {
+  /* Train the networks until every lane has met the error criterion, or for C cycles.
+   * ii[]: input patterns
+   * tt[]: associated target patterns (to calculate recall errors) */
+  printf("learn %s (%d lanes)\n", ev->name, ev->V);
+  const int V = ev->V;
+  const int lo = ev->L - 1;
+  void (* present)(Ebpv*, double**, double**) = V == 4 ? present4 : V == 8 ? present8 : present16;
+  int live = V; // number of lanes still training
+  for (int c = 0; live > 0 && c < ev->C; c++) {
+    // learn one cycle in all lanes
+    for (int v = 0; v < V; v++) {
+      if (ev->live[v] == 0.0) continue; // a retired lane keeps its last error
+      if (ev->shuffle) shuffler(ev->P, ev->order + v * ev->P, &ev->seed[v]);
+      ev->e[v] = 0.0;
+    }
+    present(ev, ii, tt);
+    // update the weights of the live lanes at end of cycle
+    for (int l = 0; l < ev->L; l++) {
+      const int R = ev->N[l] * ((l == 0 ? ev->I : ev->N[l - 1]) + 1);
+      for (int k = 0; k < R; k++)
+        for (int v = 0; v < V; v++) ev->w[l][k * V + v] += ev->live[v] * ev->dw[l][k * V + v]; // (w) = (w) + (dw); retired lanes stay put
+    }
+    // retire the lanes that met the error criterion
+    for (int v = 0; v < V; v++) {
+      if (ev->live[v] == 0.0) continue;
+      ev->e[v] = sqrt(ev->e[v]) / ev->N[lo] / ev->P; // root-mean-square error; see eq 4.35, ANS p 196
+      ev->c[v] = c + 1;
+      if (ev->e[v] < ev->epsilon) {
+        ev->live[v] = 0.0;
+        live--;
+      }
+    }
+    if (c % (ev->C / 10) == 0) printf("c = %-10d  live = %d\n", c, live);
+  }
+  for (int v = 0; v < V; v++)
+    printf("v = %-3d  eta = %-8.4f  alpha = %-8.4f  c = %-10d  e = %-10.8f\n", v, ev->eta[v], ev->alpha[v], ev->c[v], ev->e[v]);
+}
+
+void recallv(Ebpv* ev, int P, double** ii, double** tt) {
+  /* Test the networks; report each lane's recall error.
+   * P: number of data patterns
+   * ii[]: input patterns
+   * tt[]: associated target patterns (to calculate recall errors) */
+  printf("recall %s\n", ev->name);
+  const int V = ev->V;
+  const int lo = ev->L - 1;
+  int* order = ev->order;
+  int* id = malloc((size_t) V * P * sizeof(int)); // every lane presents the patterns in file order; grows with the data set, so not on the stack
+  for (int v = 0; v < V; v++)
+    for (int p = 0; p < P; p++) id[v * P + p] = p;
+  const int P0 = ev->P;
+  ev->order = id;
+  ev->P = P;
+  double e[V];
+  for (int v = 0; v < V; v++) e[v] = 0.0;
+  for (int p = 0; p < P; p++) {
+    if (V == 4) forwardv(ev, ii, p, 4);
+    else if (V == 8) forwardv(ev, ii, p, 8);
+    else forwardv(ev, ii, p, 16);
+    for (int j = 0; j < ev->N[lo]; j++)
+      for (int v = 0; v < V; v++) e[v] += sqre(tt[p][j] - ev->o[lo][j * V + v]);
+  }
+  ev->order = order;
+  ev->P = P0;
+  free(id);
+  for (int v = 0; v < V; v++) printf("v = %-3d  e = %-10.8f\n", v, sqrt(e[v]) / ev->N[lo] / P);
+}
@@ -0,0 +1,41 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_LIRV_H
+#define NN_LIRV_H
+
+#include "etc.h"
+
+typedef struct Ebpv { // V independent networks of one topology, trained in lockstep, one per SIMD lane
+  char* name; // network name
+  int V; // number of lanes; 4, 8, or 16
+  double* eta; // learning rate eta[v] of lane v
+  double* alpha; // momentum factor alpha[v]
+  double epsilon; // error criterion
+  double* e; // current cycle's error e[v]
+  int* c; // number of cycles c[v] that lane v trained before it retired
+  double* live; // 1.0 while lane v trains, 0.0 once it has retired
+  int C; // number of training cycles
+  int P; // number of data patterns
+  bool shuffle; // shuffle input patterns
+  int* order; // input pattern presentation order order[v * P + p] of lane v
+  unsigned int* seed; // random seed seed[v] of lane v's shuffles
+  int L; // number of layers
+  int I; // number of input taps
+  int* N; // number of nodes N[l]
+  Actv* f; // whole-layer activation function f[l]
+  Dactv* df; // whole-layer derivative of activation function df[l]
+  double* p; // augmented input pattern p[i * V + v]
+  double** i; // augmented input vector i[l][i * V + v]; pointers i[l] -> o[l-1]
+  double** o; // augmented output vector o[l][j * V + v]
+  double** d; // delta vector d[l][j * V + v]
+  double** w; // augmented weight matrix w[l][(j * (I + 1) + i) * V + v]
+  double** dw; // augmented del-weight matrix dw[l][(j * (I + 1) + i) * V + v]
+} Ebpv;
+
+extern Ebpv* ebpvnew(const char* name, const double* eta, const double* alpha, double epsilon, int C, int P, bool shuffle, int V, int L, int I, const int* N, char** act);
+extern void ebpvdel(Ebpv* ev);
+extern void learnv(Ebpv* ev, double** ii, double** tt);
+extern void recallv(Ebpv* ev, int P, double** ii, double** tt);
+
+#endif // NN_LIRV_H
@@ -1,7 +1,8 @@
 /* Author: Amen Zwa, Esq.
  * Copyright (c) 2022 sOnit, Inc.
  * References:
- * SOM: The Self-Organizing Map, Kohonen (1990) */
+ * SOM: The Self-Organizing Map, Kohonen (1990)
+ * BM: Essentials of the Self-Organizing Map, Kohonen (2013) */
 
 #include <string.h>
 #include <stdlib.h>
@@ -10,6 +11,9 @@
 #include <float.h>
 #include "csv.h"
 #include "etc.h"
+#include "ker.h"
+#include "kdt.h"
+#include "ckp.h"
 #include "som.h"
 
 inline bool isinside(Som* som, Loc n) {
@@ -39,22 +43,57 @@ inline int side(Som* som, int c) {
   return 1 + 2 * radius(som, c);
 }
 
-static Loc* hood(Som* som, int c, int S, Loc n) {
-  /* Construct node n's neighborhood based on the current radius.
-   * See section II-B-D, SOM p 1467-1469 */
+typedef struct Rect {
+  int x0, x1, y0, y1; // nodes x0 .. x1 of rows y0 .. y1
+} Rect;
+
+static Rect clip(Som* som, Loc n, int r) {
+  /* Return the square of radius r around node n, clipped to the map. */
+  return (Rect) {.x0 = n.x - r < 0 ? 0 : n.x - r, .x1 = n.x + r < som->W ? n.x + r : som->W - 1,
+                 .y0 = n.y - r < 0 ? 0 : n.y - r, .y1 = n.y + r < som->H ? n.y + r : som->H - 1};
+}
+
+static double sigma(Som* som, int c) {
+  /* Return the width of the batch rule's neighborhood, which shrinks geometrically from radius to RADIUS_MIN over the C cycles.
+   * Without a learning factor to damp it, a neighborhood held wide through an ordering phase would pull every code vector to the mean of all patterns. */
+  return som->radius * pow((double) RADIUS_MIN / som->radius, (double) c / som->C);
+}
+
+static void table(Som* som, int c) {
+  /* Tabulate the learning factors of the neighborhood for cycle c, over which the radius and the decay stay put.
+   * Monotonically decrease alpha after the ordering phase; the Gaussian kernel also decreases it away from the winner, and the cut kernel
+   * zeroes it beyond the radius, so the neighborhood is a disc rather than a square.
+   * The factor of the node at (dx, dy) from the winner is tab[(dy + tr) * side + dx + tr]. */
   const int r = radius(som, c);
-  Loc tl = (Loc) {.x = n.x - r, .y = n.y - r}; // top-left corner of the neighborhood
-  for (int y = 0; y < S; y++)
-    for (int x = 0; x < S; x++) som->hood[toindex(S, x, y)] = (Loc) {.x = tl.x + x, .y = tl.y + y};
-  return som->hood;
+  const int S = side(som, c);
+  som->tr = r;
+  for (int dy = -r; dy <= r; dy++)
+    for (int dx = -r; dx <= r; dx++) {
+      const double d = (sqre(dx) + sqre(dy)) / sqre(r); // scaled squared Euclidean distance
+      double a = som->alpha;
+      if (!isordering(c)) {
+        a = som->kernel == BUBBLE ? som->alpha * exp(-(double) c / som->C) : som->alpha * exp(-d - (double) c / som->C); // see eq 8, section II-B, SOM p 1467
+        if (a <= ALPHA_MIN) a = ALPHA_MIN;
+      }
+      if (som->kernel == CUTGAUSSIAN && d > 1.0) a = 0.0;
+      som->tab[toindex(S, dx + r, dy + r)] = a;
+    }
+}
+
+static double* code(Som* som, Loc n) {
+  /* Return node n's code vector, a row of the codebook. */
+  return som->m + (size_t) toindex(som->W, n.x, n.y) * som->S;
+}
+
+static void norms(Som* som) {
+  /* Recompute the squared norms of all code vectors. */
+  for (int r = 0; r < som->H * som->W; r++) som->q[r] = kerdot(som->S, som->m + (size_t) r * som->S, som->m + (size_t) r * som->S);
 }
 
-static double alpha(Som* som, int c, Loc nc, Loc n) {
-  /* Monotonically decrease alpha after the ordering phase, and return the alpha for a node in the neighborhood. */
-  if (isordering(c)) return som->alpha;
-  const double d = (sqre(n.x - nc.x) + sqre(n.y - nc.y)) / sqre(radius(som, c)); // scaled squared Euclidean distance
-  const double a = som->alpha * exp(-d - (double) c / som->C); // see eq 8, section II-B, SOM p 1467
-  return a <= ALPHA_MIN ? ALPHA_MIN : a;
+static int block(Som* som) {
+  /* Return the length of a thread's block of the batch rule's pattern-codebook products, which also holds a code vector sum. */
+  const int n = PB * kerpad(som->H * som->W);
+  return n > som->S ? n : som->S;
 }
 
 void dump(Som* som) {
@@ -74,7 +113,7 @@ inline void report(Som* som, int c) {
 
 /* self-organizing map */
 
-Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool shuffle, int I, int H, int W, Dist dist) {
+Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool shuffle, int I, int H, int W, Dist dist, Rule rule, int T, int split, Search search, Kernel kernel) {
   /* Create a network.
    * name: network name for use in report()
    * alpha: learning factor
@@ -85,7 +124,12 @@ Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool s
    * I: number of input taps
    * H: height of the map
    * W: width of the map
-   * dist: distance measure */
+   * dist: distance measure
+   * rule: learning rule
+   * T: number of threads of the batch rule, and of the online rule on a large map
+   * split: map size (in nodes) from which the online rule uses the T threads
+   * search: winner search of the online rule after the ordering phase
+   * kernel: neighborhood kernel of the online rule */
   Som* som = malloc(sizeof(Som));
   som->name = strndup(name, FLDSIZ); // malloc()
   som->alpha = alpha;
@@ -104,39 +148,101 @@ Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool s
   som->H = H;
   som->W = W;
   som->radius = som->W / 2; // see section II-D, SOM p 1469
-  const int S = side(som, 0);
-  som->hood = malloc(S * S * sizeof(Loc)); // 1D array representing the 2D neighborhood square
+  const int S = side(som, 0); // the widest neighborhood
+  som->kernel = kernel;
+  som->tab = malloc(S * S * sizeof(double)); // 1D array representing the 2D neighborhood square
+  som->tr = som->radius;
   som->dist = dist;
   som->i = vecnew(som->I);
-  som->m = malloc(som->H * sizeof(Vec**));
+  som->watch = NULL;
+  som->watcher = NULL;
+  som->ckp = NULL;
+  som->c0 = 0;
+  som->S = kerpad(som->I);
+  som->m = keralloc(som->H * som->W * som->S); // zero padding, so the kernels run over whole rows
+  som->q = keralloc(som->H * som->W);
+  som->x = keralloc(som->I);
   som->hits = malloc(som->H * sizeof(int*));
   for (int y = 0; y < som->H; y++) {
-    som->m[y] = malloc(som->W * sizeof(Vec*));
     som->hits[y] = malloc(som->W * sizeof(int));
     for (int x = 0; x < som->W; x++) {
-      som->m[y][x] = vecnew(som->I);
-      for (int i = 0; i < som->I; i++) som->m[y][x]->c[i] = randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
+      double* w = code(som, (Loc) {.x = x, .y = y});
+      for (int i = 0; i < som->I; i++) w[i] = randin(-WGT_RNG / 2.0, +WGT_RNG / 2.0); // symmetry breaking; see LIR p 10
       som->hits[y][x] = 0;
     }
   }
+  norms(som);
+  som->rule = rule;
+  som->T = T < 1 ? 1 : T;
+  som->split = split < 1 ? SPLIT : split;
+  som->pool = NULL;
+  som->ti = som->xx = som->dd = som->sum = som->cnt = som->rs = som->rn = NULL;
+  if (som->T > 1 && som->H * som->W >= som->split) { // a thread's share of a pattern's work outweighs waking the threads for it
+    som->pool = poolnew(som->T);
+    som->ti = keralloc(som->T * som->S);
+  }
+  som->search = search;
+  som->last = NULL;
+  som->kd = NULL;
+  som->seeks = som->kept = som->scored = 0;
+  som->builds = 0;
+  if (som->search != FULL) {
+    som->last = malloc(som->P * sizeof(int));
+    for (int p = 0; p < som->P; p++) som->last[p] = -1;
+    som->kd = kdtnew(som->H * som->W, som->I, som->S);
+  }
+  if (som->rule == BATCH) {
+    const int R = som->H * som->W;
+    if (som->pool == NULL) som->pool = poolnew(som->T);
+    som->xx = keralloc(som->P * som->S);
+    som->dd = keralloc(som->T * block(som));
+    som->sum = keralloc(som->T * R * som->S);
+    som->cnt = keralloc(som->T * kerpad(R));
+    som->rs = keralloc(R * som->S);
+    som->rn = keralloc(R);
+  }
   return som;
 }
 
 void somdel(Som* som) {
   /* Destroy the network. */
-  for (int y = 0; y < som->H; y++) {
-    for (int x = 0; x < som->W; x++) vecdel(som->m[y][x]);
-    free(som->hits[y]);
-    free(som->m[y]);
+  if (som->pool != NULL) {
+    pooldel(som->pool);
+    som->pool = NULL;
   }
+  if (som->kd != NULL) {
+    kdtdel(som->kd);
+    som->kd = NULL;
+  }
+  free(som->last);
+  som->last = NULL;
+  free(som->ti);
+  som->ti = NULL;
+  free(som->rn);
+  som->rn = NULL;
+  free(som->rs);
+  som->rs = NULL;
+  free(som->cnt);
+  som->cnt = NULL;
+  free(som->sum);
+  som->sum = NULL;
+  free(som->dd);
+  som->dd = NULL;
+  free(som->xx);
+  som->xx = NULL;
+  for (int y = 0; y < som->H; y++) free(som->hits[y]);
   free(som->hits);
   som->hits = NULL;
+  free(som->x);
+  som->x = NULL;
+  free(som->q);
+  som->q = NULL;
   free(som->m);
   som->m = NULL;
   vecdel(som->i);
   som->i = NULL;
-  free(som->hood);
-  som->hood = NULL;
+  free(som->tab);
+  som->tab = NULL;
   free(som->ord);
   som->ord = NULL;
   free(som->name);
@@ -144,55 +250,382 @@ void somdel(Som* som) {
   free(som);
 }
 
+typedef struct Part {
+  Som* som; // network whose threads share the pattern
+  const Vec* v; // current pattern
+  Loc nc; // its winner
+  int c; // current cycle
+  int* k; // nearest node k[t] of thread t's share of the map
+  double* d; // its distance d[t]; see winner()
+} Part;
+
+static bool wide(Som* som) {
+  /* Check if each pattern's winner search and update are split among the pool's threads. */
+  return som->pool != NULL && som->H * som->W >= som->split;
+}
+
+static void scan(void* arg, int t) {
+  /* Thread t finds the nearest node of its contiguous share of the codebook. */
+  Part* pt = arg;
+  Som* som = pt->som;
+  const int R = som->H * som->W;
+  const int r0 = (int) ((long) R * t / som->T);
+  const int r1 = (int) ((long) R * (t + 1) / som->T);
+  const double* m = som->m + (size_t) r0 * som->S;
+  pt->k[t] = r0 + (som->dist == EUCLIDEAN ? kernear(r1 - r0, som->S, m, som->x, -2.0, som->q + r0, &pt->d[t])
+                                          : kernear(r1 - r0, som->S, m, som->x, 1.0, NULL, &pt->d[t]));
+}
+
 static Loc winner(Som* som, const Vec* p) {
-  /* Select the winner. */
-  Loc n = {.x = -1, .y = -1}; // winner
-  double min = DBL_MAX;
-  for (int y = 0; y < som->H; y++)
-    for (int x = 0; x < som->W; x++) {
-      double d = som->dist(p, som->m[y][x]);
-      if (d < min) { // see eq 2', section II-B, SOM p 1467
-        n = (Loc) {.x = x, .y = y};
-        min = d;
+  /* Select the winner, the node whose code vector is nearest the pattern, in one pass over the codebook.
+   * For the Euclidean distance, ||[x] - [m]||^2 = ||[x]||^2 + ||[m]||^2 - 2 [m] . [x], in which ||[x]||^2 is the same for all nodes,
+   * so the winner minimises ||[m]||^2 - 2 [m] . [x] over the precomputed norms, without a square root per node.
+   * On a wide map, the threads scan their shares of the codebook, and the nearest nodes of the shares are reduced in thread order, so the first node wins a tie. */
+  memcpy(som->x, p->c, som->I * sizeof(double));
+  int r;
+  if (wide(som)) {
+    int k[som->T];
+    double d[som->T];
+    Part pt = {.som = som, .k = k, .d = d};
+    poolrun(som->pool, scan, &pt);
+    r = k[0];
+    double min = d[0];
+    for (int t = 1; t < som->T; t++)
+      if (d[t] < min) {
+        r = k[t];
+        min = d[t];
       }
+  } else {
+    double d;
+    r = som->dist == EUCLIDEAN ? kernear(som->H * som->W, som->S, som->m, som->x, -2.0, som->q, &d)
+                               : kernear(som->H * som->W, som->S, som->m, som->x, 1.0, NULL, &d); // see eq 2', section II-B, SOM p 1467
+  }
+  return (Loc) {.x = r % som->W, .y = r / som->W};
+}
+
+static void drifted(Som* som, int r) {
+  /* Note how far node r's code vector has drifted from its snapshot in the k-d tree. */
+  kdtmove(som->kd, r, kdtdist(som->I, som->m + (size_t) r * som->S, som->kd->p + (size_t) r * som->S));
+}
+
+static void update(Som* som, const Vec* x, Loc nc, int y0, int y1, const Rect* b, double* i, bool track) {
+  /* Update the weights of the rows y0 .. y1 of winner nc's neighborhood, clipped to the map (b), with the cycle's learning factors.
+   * Each row of the neighborhood is a contiguous run of the codebook, swept in one pass with a fused kernel, and so is its row of the table.
+   * i: temporary store for alpha * [x]
+   * track: note the code vectors' drift in the k-d tree */
+  const int S = 1 + 2 * som->tr;
+  for (int y = y0; y <= y1; y++) {
+    const double* a = som->tab + toindex(S, b->x0 - nc.x + som->tr, y - nc.y + som->tr);
+    double* w = code(som, (Loc) {.x = b->x0, .y = y}); // [w] = [m]_node
+    for (int r = toindex(som->W, b->x0, y); r <= toindex(som->W, b->x1, y); r++, a++, w += som->S) {
+      if (*a == 0.0) continue; // beyond a cut kernel
+      kerstep(som->I, *a, x->c, w, i); // [i] = alpha * ([x] - [w]); [w] = [w] + [i]; see eq 6, section II-B, SOM p 1467
+      if (som->dist == EUCLIDEAN) som->q[r] = kerdot(som->S, w, w);
+      if (track) drifted(som, r);
     }
-  return n;
+  }
 }
 
-static void update(Som* som, const Vec* x, Loc n, double a) {
-  /* Update the weights of the winner and its neighborhood. */
-  Vec* w = som->m[n.y][n.x]; // [w] = [m]_winner
-  vecsub(som->i, x, w); // [i] = [x] - [w]
-  vecscale(som->i, a, som->i); // [i] = alpha * [i]
-  vecadd(w, w, som->i); // [w] = [w] + [i]; see eq 6, section II-B, SOM p 1467
+static int window(Som* som, int r, double* bs, bool* inside) {
+  /* Return the node nearest the pattern in som->x in the window around node r, clipped to the map, and leave its score in bs,
+   * and whether it lies inside the window, rather than on an edge beyond which the map goes on.
+   * Each row of the window is a contiguous run of the codebook, scored by kernear() as in winner(), so that both searches rank the nodes alike. */
+  const Loc n = {.x = r % som->W, .y = r / som->W};
+  const Rect wn = clip(som, n, WINDOW);
+  const int x0 = wn.x0, x1 = wn.x1, y0 = wn.y0, y1 = wn.y1;
+  int b = toindex(som->W, n.x, n.y);
+  *bs = DBL_MAX;
+  for (int y = y0; y <= y1; y++) {
+    const int r0 = toindex(som->W, x0, y);
+    double d;
+    const int k = r0 + kernear(x1 - x0 + 1, som->S, som->m + (size_t) r0 * som->S, som->x, -2.0, som->q + r0, &d);
+    if (d < *bs) { // rows in order, so the lower index wins a tie
+      b = k;
+      *bs = d;
+    }
+  }
+  som->scored += (long) (x1 - x0 + 1) * (y1 - y0 + 1);
+  const Loc nb = {.x = b % som->W, .y = b / som->W};
+  *inside = (nb.x > x0 || x0 == 0) && (nb.x < x1 || x1 == som->W - 1) && (nb.y > y0 || y0 == 0) && (nb.y < y1 || y1 == som->H - 1);
+  return b;
 }
 
-void learn(Som* som, Vec** ii) {
-  /* Train the network.
-   * ii[]: input patterns */
-  printf("learn %s\n", som->name);
-  for (int c = 0; som->e > som->epsilon && c < som->C; c++) {
-    som->e = 0.0;
-    if (som->shuffle) shuffle(som->P, som->ord);
-    for (int p = 0; p < som->P; p++) {
-      // select the winner
-      const Vec* v = ii[som->ord[p]];
-      Loc nc = winner(som, v);
-      som->hits[nc.y][nc.x]++; // update winner's hits
-      // update weights of winner and its neighborhood
-      const int S = side(som, c);
-      Loc* hc = hood(som, c, S, nc);
-      for (int y = 0; y < S; y++)
-        for (int x = 0; x < S; x++) {
-          Loc n = hc[toindex(S, x, y)];
-          if (isinside(som, n)) update(som, v, n, alpha(som, c, nc, n));
+static Loc seek(Som* som, const Vec* v, int id) {
+  /* Select the winner of pattern id, starting from its last winner.
+   * Once the map is ordered, a pattern's winner moves little from one cycle to the next, so the nearest node around the last winner is
+   * most often the winner; the exact search confirms it through the k-d tree, which, starting from its distance, prunes all but a few leaves.
+   * The nodes are scored as in winner(), so the exact search picks the same winner as the full scan, ties included. */
+  memcpy(som->x, v->c, som->I * sizeof(double));
+  int r = -1;
+  double bs = DBL_MAX;
+  bool inside = false;
+  if (som->last[id] >= 0) r = window(som, som->last[id], &bs, &inside);
+  const int r0 = r;
+  if (som->search == EXACT || !inside) som->scored += kdtnear(som->kd, som->m, som->q, som->x, &r, &bs);
+  som->seeks++;
+  if (r == r0) som->kept++;
+  som->last[id] = r;
+  return (Loc) {.x = r % som->W, .y = r / som->W};
+}
+
+static void adapt(void* arg, int t) {
+  /* Thread t updates its contiguous share of the rows of the winner's neighborhood, clipped to the map. */
+  Part* pt = arg;
+  Som* som = pt->som;
+  const Rect b = clip(som, pt->nc, som->tr);
+  const int n = b.y1 - b.y0 + 1; // number of rows
+  const int y0 = b.y0 + (int) ((long) n * t / som->T);
+  const int y1 = b.y0 + (int) ((long) n * (t + 1) / som->T) - 1;
+  update(som, pt->v, pt->nc, y0, y1, &b, som->ti + (size_t) t * som->S, false); // the slacks are raised after the threads are done; see online()
+}
+
+static void snapshot(Som* som, int c) {
+  /* Checkpoint the training state at the end of cycle c, if a checkpoint is due; the writer thread writes it out. */
+  Ckp* ck = som->ckp;
+  if (ck == NULL || !ckpbegin(ck, c)) return;
+  const int hd[6] = {som->I, som->H, som->W, som->P, som->search, c + 1}; // topology and winner search, then the next cycle
+  const unsigned int rng = rngstate();
+  ckpput(ck, hd, sizeof(hd));
+  ckpput(ck, &som->e, sizeof(double));
+  ckpput(ck, &rng, sizeof(rng));
+  ckpput(ck, som->ord, som->P * sizeof(int));
+  for (int y = 0; y < som->H; y++) {
+    for (int x = 0; x < som->W; x++) ckpput(ck, code(som, (Loc) {.x = x, .y = y}), som->I * sizeof(double));
+    ckpput(ck, som->hits[y], som->W * sizeof(int));
+  }
+  if (som->last != NULL) ckpput(ck, som->last, som->P * sizeof(int));
+  ckpend(ck);
+}
+
+void somresume(Som* som, Ckp* ck) {
+  /* Restore the training state from the opened checkpoint, so that learn() picks up where the checkpoint left off, with the same results as if it had never stopped. */
+  int hd[6];
+  ckpget(ck, hd, sizeof(hd));
+  if (hd[0] != som->I || hd[1] != som->H || hd[2] != som->W || hd[3] != som->P || hd[4] != (int) som->search) {
+    fprintf(stderr, "ERROR: checkpoint %s does not fit network %s\n", ck->file, som->name);
+    exit(1);
+  }
+  unsigned int rng;
+  som->c0 = hd[5];
+  ckpget(ck, &som->e, sizeof(double));
+  ckpget(ck, &rng, sizeof(rng));
+  ckpget(ck, som->ord, som->P * sizeof(int));
+  for (int y = 0; y < som->H; y++) {
+    for (int x = 0; x < som->W; x++) ckpget(ck, code(som, (Loc) {.x = x, .y = y}), som->I * sizeof(double));
+    ckpget(ck, som->hits[y], som->W * sizeof(int));
+  }
+  if (som->last != NULL) ckpget(ck, som->last, som->P * sizeof(int));
+  norms(som);
+  rngseed(rng);
+}
+
+static double online(Som* som, Vec** ii, int c) {
+  /* Present the patterns one by one, updating the winner and its neighborhood after each, and return the cycle's error. */
+  double e = 0.0;
+  const bool fast = som->search != FULL && !isordering(c); // the codebook moves too much to track during the ordering phase
+  if (fast && (som->kd->N == 0 || sqrt(som->kd->sl[0]) > DRIFT * som->kd->spread)) { // rebuild the tree lazily, once it is too loose to prune well
+    kdtbuild(som->kd, som->m);
+    som->builds++;
+  }
+  table(som, c);
+  if (som->shuffle) shuffle(som->P, som->ord);
+  for (int p = 0; p < som->P; p++) {
+    // select the winner
+    const Vec* v = ii[som->ord[p]];
+    Loc nc = fast ? seek(som, v, som->ord[p]) : winner(som, v);
+    som->hits[nc.y][nc.x]++; // update winner's hits
+    // update weights of winner and its neighborhood
+    if (wide(som)) {
+      Part pt = {.som = som, .v = v, .nc = nc, .c = c};
+      poolrun(som->pool, adapt, &pt);
+      memcpy(som->i->c, som->ti + (size_t) (som->T - 1) * som->S, som->I * sizeof(double)); // the last thread updated the last node
+      if (fast) { // the tree nodes' slacks are shared among the threads' nodes, so they are raised here, on one thread
+        const Rect b = clip(som, nc, som->tr);
+        for (int y = b.y0; y <= b.y1; y++)
+          for (int x = b.x0; x <= b.x1; x++) drifted(som, toindex(som->W, x, y));
+      }
+    } else {
+      const Rect b = clip(som, nc, som->tr);
+      update(som, v, nc, b.y0, b.y1, &b, som->i->c, fast);
+    }
+    e += vecfold(sumsqre, 0.0, som->i);
+  }
+  return sqrt(e) / (som->W + som->H) / som->P;
+}
+
+typedef struct Batch {
+  Som* som; // network whose threads share the cycle
+  int rc; // cut-off of the neighborhood, in nodes along a row or a column
+  const double* g; // neighborhood g[d] at d nodes along a row or a column, out to rc
+  double* e; // squared change e[t] of the code vectors updated by thread t
+} Batch;
+
+static void assign(void* arg, int t) {
+  /* Thread t finds the winners of its contiguous share of the patterns, PB patterns at a time, and sums the patterns won by each node.
+   * The distances of a block of patterns to all the code vectors come from one matrix product with the codebook; see winner(). */
+  Som* som = ((Batch*) arg)->som;
+  const int R = som->H * som->W;
+  const int ld = kerpad(R);
+  double* dd = som->dd + (size_t) t * block(som);
+  double* sum = som->sum + (size_t) t * R * som->S;
+  double* cnt = som->cnt + (size_t) t * ld;
+  memset(sum, 0, (size_t) R * som->S * sizeof(double));
+  memset(cnt, 0, R * sizeof(double));
+  const int p0 = (int) ((long) som->P * t / som->T);
+  const int p1 = (int) ((long) som->P * (t + 1) / som->T);
+  const bool euclidean = som->dist == EUCLIDEAN;
+  for (int b = p0; b < p1; b += PB) {
+    const int n = b + PB < p1 ? PB : p1 - b;
+    const double* xx = som->xx + (size_t) b * som->S;
+    kergemmnt(n, R, som->S, euclidean ? -2.0 : 1.0, xx, som->S, som->m, som->S, 0.0, dd, ld); // (dd) = a * (xx) * (m)'
+    for (int p = 0; p < n; p++) {
+      const double* d = dd + (size_t) p * ld;
+      int k = 0;
+      double min = DBL_MAX;
+      for (int r = 0; r < R; r++) {
+        const double dr = euclidean ? som->q[r] + d[r] : d[r];
+        if (dr < min) { // see eq 2', section II-B, SOM p 1467
+          k = r;
+          min = dr;
         }
-      som->e += vecfold(sumsqre, 0.0, som->i);
+      }
+      keraxpy(som->S, 1.0, xx + (size_t) p * som->S, sum + (size_t) k * som->S);
+      cnt[k] += 1.0;
     }
+  }
+}
+
+static void fold(void* arg, int t) {
+  /* Thread t folds all threads' sums and counts into thread 0's, in thread order, for its share of the nodes, and counts their hits.
+   * Folding in a fixed order makes the result reproducible for a given number of threads. */
+  Som* som = ((Batch*) arg)->som;
+  const int R = som->H * som->W;
+  const int ld = kerpad(R);
+  const int r0 = (int) ((long) R * t / som->T);
+  const int r1 = (int) ((long) R * (t + 1) / som->T);
+  for (int s = 1; s < som->T; s++) {
+    keraxpy((r1 - r0) * som->S, 1.0, som->sum + ((size_t) s * R + r0) * som->S, som->sum + (size_t) r0 * som->S);
+    keraxpy(r1 - r0, 1.0, som->cnt + (size_t) s * ld + r0, som->cnt + r0);
+  }
+  for (int r = r0; r < r1; r++) som->hits[r / som->W][r % som->W] += (int) som->cnt[r];
+}
+
+static void blur(void* arg, int t) {
+  /* Thread t smooths the sums and counts of its share of the nodes along their rows of the map; the first pass of smooth(). */
+  Batch* ba = arg;
+  Som* som = ba->som;
+  const int R = som->H * som->W;
+  const int r0 = (int) ((long) R * t / som->T);
+  const int r1 = (int) ((long) R * (t + 1) / som->T);
+  for (int r = r0; r < r1; r++) {
+    const Loc nj = {.x = r % som->W, .y = r / som->W};
+    const Rect b = clip(som, nj, ba->rc);
+    double* rs = som->rs + (size_t) r * som->S;
+    memset(rs, 0, som->S * sizeof(double));
+    som->rn[r] = 0.0;
+    for (int x = b.x0; x <= b.x1; x++) {
+      const int i = toindex(som->W, x, nj.y);
+      if (som->cnt[i] == 0.0) continue;
+      const double h = ba->g[abs(x - nj.x)];
+      keraxpy(som->S, h, som->sum + (size_t) i * som->S, rs);
+      som->rn[r] += h * som->cnt[i];
+    }
+  }
+}
+
+static void smooth(void* arg, int t) {
+  /* Thread t replaces the code vectors of its share of the nodes by the neighborhood-weighted means of the patterns won around them.
+   * [m]_j = sum_i h(j, i) [sum]_i / sum_i h(j, i) cnt_i, where the neighborhood h(j, i) = exp(-d(j, i)^2 / 2 sigma^2), cut off at 3 sigma; see BM
+   * The neighborhood is the product of a Gaussian along the row and one along the column, so blur() sums along the rows and this pass along the columns,
+   * at O(sigma) rather than O(sigma^2) nodes per node. */
+  Batch* ba = arg;
+  Som* som = ba->som;
+  const int R = som->H * som->W;
+  const int r0 = (int) ((long) R * t / som->T);
+  const int r1 = (int) ((long) R * (t + 1) / som->T);
+  double* num = som->dd + (size_t) t * block(som); // thread t's block is free until the next cycle's assign()
+  ba->e[t] = 0.0;
+  for (int r = r0; r < r1; r++) {
+    const Loc nj = {.x = r % som->W, .y = r / som->W};
+    const Rect b = clip(som, nj, ba->rc);
+    memset(num, 0, som->S * sizeof(double));
+    double den = 0.0;
+    for (int y = b.y0; y <= b.y1; y++) {
+      const int i = toindex(som->W, nj.x, y);
+      if (som->rn[i] == 0.0) continue;
+      const double h = ba->g[abs(y - nj.y)];
+      keraxpy(som->S, h, som->rs + (size_t) i * som->S, num);
+      den += h * som->rn[i];
+    }
+    if (den == 0.0) continue; // no pattern won around node j, so its code vector stays
+    double* w = som->m + (size_t) r * som->S;
+    for (int k = 0; k < som->I; k++) {
+      const double mk = num[k] / den;
+      ba->e[t] += sqre(mk - w[k]);
+      w[k] = mk;
+    }
+    if (som->dist == EUCLIDEAN) som->q[r] = kerdot(som->S, w, w);
+  }
+}
+
+static double batch(Som* som, int c) {
+  /* Assign all the patterns to their winners, and then update all the code vectors at once, on the pool's threads; return the cycle's error.
+   * The code vectors do not change during the assignment, so the pattern order does not matter. */
+  const double sg = sigma(som, c);
+  const int rc = (int) ceil(3.0 * sg);
+  double g[rc + 1];
+  for (int d = 0; d <= rc; d++) g[d] = exp(-sqre(d) / (2.0 * sqre(sg)));
+  double e[som->T];
+  Batch ba = {.som = som, .rc = rc, .g = g, .e = e};
+  poolrun(som->pool, assign, &ba);
+  poolrun(som->pool, fold, &ba);
+  poolrun(som->pool, blur, &ba);
+  poolrun(som->pool, smooth, &ba);
+  double de = 0.0;
+  for (int t = 0; t < som->T; t++) de += e[t];
+  return sqrt(de) / (som->W + som->H); // RMS-like change of the code vectors, as the online rule's error is of its updates
+}
+
+void learn(Som* som, Vec** ii) {
+  /* Train the network, from cycle c0, and checkpoint its state into ckp, if any, every so many cycles.
+   * ii[]: input patterns */
+  if (som->watch == NULL) printf("learn %s\n", som->name);
+  if (som->rule == BATCH)
+    for (int p = 0; p < som->P; p++) memcpy(som->xx + (size_t) p * som->S, ii[p]->c, som->I * sizeof(double));
+  for (int c = som->c0; som->e > som->epsilon && c < som->C; c++) {
+    som->e = som->rule == BATCH ? batch(som, c) : online(som, ii, c);
     // report training error
-    som->e = sqrt(som->e) / (som->W + som->H) / som->P;
-    if (som->e < som->epsilon || c % (som->C / 10) == 0) report(som, c);
+    if (som->watch != NULL) {
+      if (!som->watch(som->watcher, c, som->C, som->e)) break;
+    } else if (som->e < som->epsilon || c % (som->C / 10) == 0) report(som, c);
+    snapshot(som, c);
+  }
+}
+
+void probe(Som* som, Vec** ii) {
+  /* Report how the fast winner search fared during the training, and the work it saved against the full scan, which is the same from run to run;
+   * then time it over the patterns, repeated for at least GAUGE seconds, against the full scan, on a line of its own. */
+  if (som->seeks == 0) {
+    printf("search %s: no fast searches; the training ended within the ordering phase\n", som->name);
+    return;
   }
+  const long seeks = som->seeks, kept = som->kept, scored = som->scored;
+  const double per = (double) scored / seeks; // code vectors scored per search
+  printf("search %s: %s, %.1f%% of %ld searches kept the winner around the last one, %.1f of %d code vectors scored per search (%.2fx less work), %d k-d tree builds\n",
+         som->name, som->search == EXACT ? "exact" : "approx", 100.0 * kept / seeks, seeks, per, som->H * som->W, som->H * som->W / per, som->builds);
+  kdtbuild(som->kd, som->m); // the trained codebook stays put, so the tree prunes without slack
+  long n = 0, f = 0;
+  double t0 = now(), t = t0;
+  for (; t - t0 < GAUGE; t = now(), n += som->P)
+    for (int p = 0; p < som->P; p++) seek(som, ii[p], p);
+  const double ts = (t - t0) / (double) n;
+  for (t0 = t = now(); t - t0 < GAUGE; t = now(), f += som->P)
+    for (int p = 0; p < som->P; p++) winner(som, ii[p]);
+  const double tf = (t - t0) / (double) f;
+  printf("  winner search %.3f us per pattern against %.3f us for a full scan; speedup %.2fx\n", ts * 1.0e6, tf * 1.0e6, tf / ts);
+  som->seeks = seeks; // the timing's searches are not the training's
+  som->kept = kept;
+  som->scored = scored;
 }
 
 void recall(Som* som, Vec** ii) {
@@ -204,7 +637,8 @@ void recall(Som* som, Vec** ii) {
     // select the winner
     const Vec* v = ii[p];
     Loc nc = winner(som, v);
-    som->e += vecfold(sumsqre, 0.0, som->i);
+    const double* w = code(som, nc);
+    for (int i = 0; i < som->I; i++) som->e += sqre(v->c[i] - w[i]); // quantisation error; the training rules' updates are stale here
     // show pattern-winner association
     printf("p = %-10d ", p);
     for (int i = 0; i < v->C; i++) printf("| %+10.4f ", v->c[i]);
@@ -5,16 +5,45 @@
 #define NN_SOM_H
 
 #include "vec.h"
+#include "etc.h"
+#include "thr.h"
+#include "kdt.h"
+#include "ckp.h"
 
 #define ORDERING 1000 // number of cycles for early, ordering phase
 #define RADIUS_MIN 1 // minimum neighborhood radius
 #define ALPHA_MIN 0.1 // ending learning factor
+#define PB 32 // patterns per block of the batch rule's winner search
+#define WINDOW 2 // radius of the window around a pattern's last winner, in which the fast winner search looks first
+#define DRIFT 0.5 // largest drift of the code vectors from the k-d tree's snapshot, against the mean size of its leaves, before the tree is rebuilt
+#define GAUGE 0.2 // least time (in seconds) over which probe() times each winner search
+#define SPLIT 16384 // default map size (in nodes) from which each pattern's winner search and update are split among the threads
 
 typedef struct Loc {
   int x, y; // node location on the map
 } Loc;
 
-typedef double (* Dist)(const Vec* u, const Vec* v);
+typedef enum Dist {
+  INNER, // inner product
+  EUCLIDEAN, // Euclidean distance
+} Dist;
+
+typedef enum Rule {
+  ONLINE, // the winner and its neighborhood learn from each pattern in turn; see eq 6, section II-B, SOM p 1467
+  BATCH, // each cycle, every code vector becomes the neighborhood-weighted mean of the patterns won around it; see BM
+} Rule;
+
+typedef enum Kernel {
+  GAUSSIAN, // the learning factor decreases with the squared distance from the winner; see eq 8, section II-B, SOM p 1467
+  BUBBLE, // the same learning factor throughout the square neighborhood; see eq 6, section II-B, SOM p 1467
+  CUTGAUSSIAN, // the Gaussian kernel, cut off beyond the radius
+} Kernel;
+
+typedef enum Search {
+  FULL, // scan the whole codebook for each pattern
+  EXACT, // look around each pattern's last winner first, and then confirm the nearest node there, or find a nearer one, through a k-d tree
+  APPROX, // accept the nearest node around each pattern's last winner when it is inside the window, and otherwise search as EXACT
+} Search;
 
 typedef struct Som {
   char* name; // network name
@@ -28,17 +57,46 @@ typedef struct Som {
   int I; // input vector length
   int H, W; // network dimensions
   int radius; // beginning neighborhood radius
-  Loc* hood; // neighborhood around the winner
+  Kernel kernel; // neighborhood kernel of the online rule
+  double* tab; // learning factors of the neighborhood around the winner, tabulated once per cycle by table()
+  int tr; // radius of the tabulated neighborhood
   Dist dist; // distance measure
   Vec* i; // temporary store for alpha * [x]
-  Vec*** m; // grid of code vectors m[r][c] = w[i]
+  int S; // code vector stride; I padded to whole cache lines
+  double* m; // codebook; the code vector of node (x, y) is the row y * W + x of this (H * W x S) aligned matrix
+  double* q; // squared norms of the code vectors, kept up to date with m for the Euclidean winner search
+  double* x; // temporary store for the input pattern, padded to S
   int** hits; // hits per node
+  Rule rule; // learning rule
+  int T; // number of threads of the batch rule, and of the online rule on a map of at least split nodes
+  int split; // map size (in nodes) from which the online rule splits each pattern's winner search and update among the T threads
+  Pool* pool; // persistent threads; NULL for the online rule on a smaller map, or on one thread
+  double* ti; // per-thread temporary stores for alpha * [x] of the split update; see i
+  double* xx; // patterns of the batch rule, padded to S, one per row
+  double* dd; // per-thread blocks of the batch rule's pattern-codebook products
+  double* sum; // per-thread sums of the patterns won by each node
+  double* cnt; // per-thread numbers of the patterns won by each node
+  double* rs; // sums of the patterns won by each node, smoothed along the rows of the map
+  double* rn; // numbers of the patterns won by each node, smoothed along the rows of the map
+  Search search; // winner search of the online rule after the ordering phase
+  int* last; // each pattern's winner in the fast search, -1 for none yet
+  Kdt* kd; // k-d tree over a snapshot of the codebook; NULL for the full search
+  long seeks; // number of fast searches
+  long kept; // number of fast searches whose winner was the nearest node around the last winner
+  long scored; // number of code vectors scored by the fast searches
+  int builds; // number of k-d tree builds
+  Watch watch; // watches the training after every cycle, instead of report(); NULL reports to stdout
+  void* watcher; // watch's argument
+  Ckp* ckp; // periodic checkpoints of the training state; NULL for none
+  int c0; // first training cycle; past 0 when resumed from a checkpoint by somresume()
 } Som;
 
-extern Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool shuffle, int I, int H, int W, Dist dist);
+extern Som* somnew(const char* name, double alpha, double epsilon, int C, int P, bool shuffle, int I, int H, int W, Dist dist, Rule rule, int T, int split, Search search, Kernel kernel);
 extern void somdel(Som* som);
+extern void somresume(Som* som, Ckp* ck);
 extern void learn(Som* som, Vec** ii);
 extern void recall(Som* som, Vec** ii);
 extern void dump(Som* som);
+extern void probe(Som* som, Vec** ii);
 
 #endif // NN_SOM_H
@@ -9,6 +9,8 @@
 #include "csv.h"
 #include "etc.h"
 #include "som.h"
+#include "ckp.h"
+#include "swp.h"
 
 static Vec** load(int P, const char* file) {
   Csv* csv = csvnew(file);
@@ -29,13 +31,40 @@ static void toss(int P, Vec** pp) {
 }
 
 static Dist dist(const char* d) {
-  if (strcmp(d, "inner") == 0) return vecinner;
-  else if (strcmp(d, "euclidean") == 0) return veceuclidean;
+  if (strcmp(d, "inner") == 0) return INNER;
+  else if (strcmp(d, "euclidean") == 0) return EUCLIDEAN;
   fprintf(stderr, "ERROR: unknown distance measure %s\n", d);
   exit(1);
 }
 
-static void run(const char* name) {
+static Rule learning(const char* r) {
+  if (r == NULL || strcmp(r, "online") == 0) return ONLINE;
+  else if (strcmp(r, "batch") == 0) return BATCH;
+  fprintf(stderr, "ERROR: unknown learning rule %s\n", r);
+  exit(1);
+}
+
+static Search seeking(const char* s) {
+  if (s == NULL || strcmp(s, "full") == 0) return FULL;
+  else if (strcmp(s, "exact") == 0) return EXACT;
+  else if (strcmp(s, "approx") == 0) return APPROX;
+  fprintf(stderr, "ERROR: unknown winner search %s\n", s);
+  exit(1);
+}
+
+static Kernel kernel(const char* k) {
+  if (k == NULL || strcmp(k, "gaussian") == 0) return GAUSSIAN;
+  else if (strcmp(k, "bubble") == 0) return BUBBLE;
+  else if (strcmp(k, "cutgaussian") == 0) return CUTGAUSSIAN;
+  fprintf(stderr, "ERROR: unknown neighborhood kernel %s\n", k);
+  exit(1);
+}
+
+static void run(const char* name, Trial* tr, int t, bool resume) {
+  /* Train the network described by dat/"name".csv.
+   * tr: sweep trial whose values override the configuration, and which watches the training quietly; NULL for a standalone run
+   * t: trial number, stored in the checkpoints of dat/"name".ckp
+   * resume: resume the training from dat/"name".ckp */
   // initialize
   char cwd[FLDSIZ];
   getcwd(cwd, sizeof(cwd)); // current working directory
@@ -43,6 +72,7 @@ static void run(const char* name) {
   sprintf(buf, "%s/dat/%s.csv", cwd, name); // ~cwd/dat/"name".csv
   Csv* cfgcsv = csvnew(buf);
   csvload(cfgcsv);
+  if (tr != NULL) sweepapply(tr, cfgcsv);
   int f = 1; // CSV field; start at 1 to skip network name field
   int C = atoi(cfgcsv->r[1][f++]); // cfgcsv->r[1] holds data, r[0] holds header
   int I = atoi(cfgcsv->r[1][f++]);
@@ -53,16 +83,55 @@ static void run(const char* name) {
   double epsilon = atof(cfgcsv->r[1][f++]);
   int P = atoi(cfgcsv->r[1][f++]);
   bool shuffle = istrue(cfgcsv->r[1][f++]);
+  const char* s = csvget(cfgcsv, 1, "checkpoint"); // optional column
+  int every = s == NULL ? 0 : atoi(s); // number of cycles between checkpoints
+  Rule rule = learning(csvget(cfgcsv, 1, "rule")); // optional column
+  s = csvget(cfgcsv, 1, "T"); // optional column
+  int T = s == NULL ? 1 : atoi(s);
+  s = csvget(cfgcsv, 1, "split"); // optional column
+  int split = s == NULL ? SPLIT : atoi(s);
+  Search search = seeking(csvget(cfgcsv, 1, "search")); // optional column
+  Kernel kn = kernel(csvget(cfgcsv, 1, "kernel")); // optional column
   csvdel(cfgcsv);
   cfgcsv = NULL;
+  if ((every > 0 || resume) && tr != NULL) {
+    fprintf(stderr, "ERROR: network %s cannot be checkpointed in a sweep\n", name);
+    exit(1);
+  }
+  if (search != FULL && (rule != ONLINE || d != EUCLIDEAN)) {
+    fprintf(stderr, "ERROR: network %s can search for its winners fast only with the online rule and the Euclidean distance\n", name);
+    exit(1);
+  }
+  if (every > 0) rngseed((unsigned int) random()); // a sequence of the thread's own, whose state a checkpoint can hold
   // load pattern vectors
   sprintf(buf, "%s/dat/%s-i.csv", cwd, name);
   Vec** ii = load(P, buf);
   // train network
-  Som* som = somnew(name, alpha, epsilon, C, P, shuffle, I, H, W, d);
-  learn(som, ii);
-  dump(som);
-  recall(som, ii);
+  Som* som = somnew(name, alpha, epsilon, C, P, shuffle, I, H, W, d, rule, T, split, search, kn);
+  if (tr != NULL) { // report only to the sweep
+    som->watch = sweepwatch;
+    som->watcher = tr;
+    learn(som, ii);
+  } else {
+    sprintf(buf, "%s/dat/%s.ckp", cwd, name);
+    if (resume) {
+      Ckp* ck = ckpopen(buf);
+      somresume(som, ck);
+      ckpdel(ck);
+      ck = NULL;
+      printf("resume %s at cycle %d\n", name, som->c0);
+    }
+    if (every > 0) som->ckp = ckpnew(buf, every, t);
+    learn(som, ii);
+    if (som->ckp != NULL) { // the trial is done, so a restart need not resume it
+      ckpdel(som->ckp);
+      som->ckp = NULL;
+      remove(buf);
+    }
+    dump(som);
+    recall(som, ii);
+    if (search != FULL) probe(som, ii);
+  }
   somdel(som);
   som = NULL;
   // terminate
@@ -70,16 +139,59 @@ static void run(const char* name) {
   ii = NULL;
 }
 
+static void trial(const char* name, Trial* tr) {
+  /* Run one trial of a sweep; see Run. */
+  run(name, tr, 0, false);
+}
+
+static void sweep(const char* name) {
+  /* Sweep the network over the grid in dat/"name"-sweep.csv, and save the trials' summaries into dat/"name"-trials.csv. */
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s-sweep.csv", cwd, name);
+  Sweep* sw = sweepnew(name, buf, trial);
+  sprintf(buf, "%s/dat/%s-trials.csv", cwd, name);
+  sweeprun(sw, buf);
+  sweepdel(sw);
+  sw = NULL;
+}
+
+static int checkpointed(const char* name) {
+  /* Return the trial number stored in dat/"name".ckp. */
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  char buf[FLDSIZ];
+  sprintf(buf, "%s/dat/%s.ckp", cwd, name);
+  Ckp* ck = ckpopen(buf);
+  if (ck == NULL) {
+    fprintf(stderr, "ERROR: cannot resume network %s without checkpoint file %s\n", name, buf);
+    exit(1);
+  }
+  const int t = ck->tag;
+  ckpdel(ck);
+  ck = NULL;
+  return t;
+}
+
 int main(int argc, const char** argv) {
   srandom(time(NULL));
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s netname\n", argv[0]);
+  const bool grid = argc == 3 && strcmp(argv[1], "-w") == 0; // sweep the hyperparameters instead of running the trials
+  const bool resume = argc == 3 && strcmp(argv[1], "--resume") == 0; // resume the trials from the checkpoint
+  if (argc != 2 && !grid && !resume) {
+    fprintf(stderr, "Usage: %s [-w | --resume] netname\n", argv[0]);
     exit(1);
   }
+  if (grid) {
+    sweep(argv[2]);
+    return 0;
+  }
+  const char* name = argv[argc - 1];
   const int T = 3; // number of trials
-  for (int t = 0; t < T; t++) {
+  const int t0 = resume ? checkpointed(name) : 0; // first trial
+  for (int t = t0; t < T; t++) {
     printf("\n---- t = %d ----\n", t);
-    run(argv[1]);
+    run(name, NULL, t, resume && t == t0);
   }
   return 0;
 }
@@ -0,0 +1,144 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Sparse matrices in compressed sparse row (CSR) form, for input patterns that are mostly one value, like one-hot codes and bags of features.
+ * The common value need not be zero; a bipolar one-hot code is mostly -1. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "csv.h"
+#include "etc.h"
+#include "spm.h"
+
+static int order(const void* a, const void* b) {
+  const double x = *(const double*) a;
+  const double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+double spmbase(int R, int C, double** a, double* density) {
+  /* Return the most common entry of the dense matrix a, and leave the fraction of the other entries in density. */
+  const long n = (long) R * C;
+  double* v = malloc(n * sizeof(double));
+  for (int r = 0; r < R; r++) memcpy(v + (long) r * C, a[r], C * sizeof(double));
+  qsort(v, n, sizeof(double), order);
+  double base = 0.0;
+  long most = 0;
+  for (long k = 0, run = 0; k < n; k++) { // longest run of equal values
+    run = k > 0 && v[k] == v[k - 1] ? run + 1 : 1;
+    if (run > most) {
+      most = run;
+      base = v[k];
+    }
+  }
+  free(v);
+  *density = n == 0 ? 0.0 : (double) (n - most) / (double) n;
+  return base;
+}
+
+Spm* spmnew(int R, int C, double** a, double base) {
+  /* Store the dense matrix a sparse, about the base value. */
+  Spm* spm = malloc(sizeof(Spm));
+  spm->R = R;
+  spm->C = C;
+  spm->base = base;
+  spm->row = malloc((R + 1) * sizeof(int));
+  int n = 0;
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) n += a[r][c] != base;
+  spm->col = malloc((n > 0 ? n : 1) * sizeof(int));
+  spm->val = malloc((n > 0 ? n : 1) * sizeof(double));
+  n = 0;
+  for (int r = 0; r < R; r++) {
+    spm->row[r] = n;
+    for (int c = 0; c < C; c++)
+      if (a[r][c] != base) {
+        spm->col[n] = c;
+        spm->val[n++] = a[r][c] - base;
+      }
+  }
+  spm->row[R] = n;
+  return spm;
+}
+
+bool spmfile(const char* file) {
+  /* Return true if the CSV file holds its patterns sparse, as "tap:value" fields; the lone "-" of a pattern without such fields tells nothing, so it is skipped. */
+  FILE* fi = fopen(file, "r");
+  if (fi == NULL) return false;
+  char* rec = NULL; // getline() buffer
+  size_t cap = 0;
+  bool sparse = false, lone = false; // a "tap:value" field, and a lone "-", found
+  while (getline(&rec, &cap, fi) >= 0) {
+    rec[strcspn(rec, "\r\n")] = '\0';
+    if (strcmp(rec, "-") == 0) {
+      lone = true;
+      continue;
+    }
+    sparse = strchr(rec, ':') != NULL;
+    break;
+  }
+  free(rec);
+  fclose(fi);
+  return sparse || lone;
+}
+
+Spm* spmload(const char* file, int R, int C) {
+  /* Load R patterns of C taps from a sparse CSV file, whose record r lists row r's non-zero taps as "tap:value" fields, with taps counted from 0.
+   * A pattern without non-zero taps is a record holding a lone "-". Unlike csvload(), this never holds a dense row, however many taps there are. */
+  FILE* fi = fopen(file, "r");
+  if (fi == NULL) {
+    fprintf(stderr, "ERROR: cannot load CSV file %s\n", file);
+    exit(1);
+  }
+  Spm* spm = malloc(sizeof(Spm));
+  spm->R = R;
+  spm->C = C;
+  spm->base = 0.0;
+  spm->row = malloc((R + 1) * sizeof(int));
+  int N = 1024; // capacity of col and val
+  spm->col = malloc(N * sizeof(int));
+  spm->val = malloc(N * sizeof(double));
+  char* rec = NULL; // getline() buffer; a record is read whole, whatever its length
+  size_t cap = 0;
+  char* z; // strtok_r() state
+  int n = 0;
+  for (int r = 0; r < R; r++) {
+    if (getline(&rec, &cap, fi) < 0) {
+      fprintf(stderr, "ERROR: cannot load all the records from CSV file %s\n", file);
+      exit(1);
+    }
+    spm->row[r] = n;
+    for (char* t, * s = rec; (t = strtok_r(s, ",\n\r", &z)) != NULL; s = NULL) {
+      if (strcmp(t, "-") == 0) continue;
+      int c;
+      double v;
+      if (sscanf(t, "%d:%lf", &c, &v) != 2 || c < 0 || c >= C) {
+        fprintf(stderr, "ERROR: bad field %s in record %d of sparse CSV file %s\n", t, r, file);
+        exit(1);
+      }
+      if (iszero(v)) continue;
+      if (n == N) {
+        N *= 2;
+        spm->col = realloc(spm->col, N * sizeof(int));
+        spm->val = realloc(spm->val, N * sizeof(double));
+      }
+      spm->col[n] = c;
+      spm->val[n++] = v;
+    }
+  }
+  spm->row[R] = n;
+  free(rec);
+  fclose(fi);
+  return spm;
+}
+
+void spmdel(Spm* spm) {
+  /* Destroy the matrix. */
+  free(spm->val);
+  spm->val = NULL;
+  free(spm->col);
+  spm->col = NULL;
+  free(spm->row);
+  spm->row = NULL;
+  free(spm);
+}
@@ -0,0 +1,26 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_SPM_H
+#define NN_SPM_H
+
+#include <stdbool.h>
+
+#define DENSITY 0.25 // largest fraction of non-base entries at which a matrix is worth storing sparse
+
+typedef struct Spm { // sparse matrix in compressed sparse row (CSR) form; the entries not stored all equal the base value
+  int R; // number of rows
+  int C; // number of columns
+  double base; // value of every entry not stored
+  int* row; // row r's entries lie at row[r] .. row[r + 1] - 1
+  int* col; // column col[k] of entry k
+  double* val; // value val[k] of entry k, less the base
+} Spm;
+
+extern double spmbase(int R, int C, double** a, double* density);
+extern Spm* spmnew(int R, int C, double** a, double base);
+extern bool spmfile(const char* file);
+extern Spm* spmload(const char* file, int R, int C);
+extern void spmdel(Spm* spm);
+
+#endif // NN_SPM_H
@@ -0,0 +1,160 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Scoring server core: dynamic batching of concurrent requests against one trained network.
+ * Requests queue up while the batching thread feeds the previous batch forward, and the oldest queued request waits at most one window for more to arrive,
+ * so at low load a request is served almost at once, and at high load every forward pass serves a full batch. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "etc.h"
+#include "srv.h"
+
+static void deadline(struct timespec* ts, double dt) {
+  /* Absolute wall clock time dt seconds from now, for pthread_cond_timedwait(). */
+  clock_gettime(CLOCK_REALTIME, ts);
+  const long ns = ts->tv_nsec + (long) (dt * 1.0e9);
+  ts->tv_sec += ns / 1000000000L;
+  ts->tv_nsec = ns % 1000000000L;
+}
+
+static int bucket(double dt) {
+  /* Latency histogram bucket of dt seconds. */
+  const double us = dt * 1.0e6;
+  if (us <= 1.0) return 0;
+  const int b = (int) (8.0 * log2(us));
+  return b < LB ? b : LB - 1;
+}
+
+static void* batcher(void* arg) {
+  /* Take up to B queued requests at a time, feed them forward together, and hand the outputs back. */
+  Srv* srv = arg;
+  const Ebp* ebp = srv->ebp;
+  const int I = ebp->I;
+  const int K = ebp->N[ebp->L - 1];
+  Req* batch[srv->B];
+  pthread_mutex_lock(&srv->mx);
+  for (;;) {
+    while (!srv->quit && srv->n == 0) pthread_cond_wait(&srv->go, &srv->mx);
+    if (srv->n == 0) break; // quit
+    // let the batch fill until the oldest request has waited one window
+    const double wait = srv->window - (now() - srv->head->t0);
+    if (srv->n < srv->B && wait > 0.0) {
+      struct timespec ts;
+      deadline(&ts, wait);
+      while (!srv->quit && srv->n < srv->B)
+        if (pthread_cond_timedwait(&srv->go, &srv->mx, &ts) != 0) break; // timed out
+    }
+    int B = 0;
+    for (; B < srv->B && srv->head != NULL; B++) {
+      batch[B] = srv->head;
+      srv->head = srv->head->next;
+    }
+    if (srv->head == NULL) srv->tail = NULL;
+    srv->n -= B;
+    pthread_mutex_unlock(&srv->mx);
+    // feed the batch forward outside the lock, so that requests keep queueing
+    for (int b = 0; b < B; b++) memcpy(srv->x + b * I, batch[b]->x, I * sizeof(double));
+    predict(ebp, B, srv->x, srv->y, srv->scratch);
+    for (int b = 0; b < B; b++) memcpy(batch[b]->y, srv->y + b * K, K * sizeof(double));
+    const double t = now();
+    pthread_mutex_lock(&srv->mx);
+    for (int b = 0; b < B; b++) {
+      batch[b]->done = true;
+      srv->count[bucket(t - batch[b]->t0)]++;
+    }
+    srv->served += B;
+    srv->batches++;
+    srv->last = t;
+    pthread_cond_broadcast(&srv->done);
+  }
+  pthread_mutex_unlock(&srv->mx);
+  return NULL;
+}
+
+Srv* srvnew(Ebp* ebp, int B, double window) {
+  /* Create a server of the network ebp that feeds forward batches of up to B requests, each waiting at most window seconds for the batch to fill. */
+  Srv* srv = malloc(sizeof(Srv));
+  srv->ebp = ebp;
+  srv->B = B < 1 ? 1 : B;
+  srv->window = window;
+  srv->x = malloc(srv->B * ebp->I * sizeof(double));
+  srv->y = malloc(srv->B * ebp->N[ebp->L - 1] * sizeof(double));
+  srv->scratch = malloc(predictsize(ebp) * sizeof(double));
+  pthread_mutex_init(&srv->mx, NULL);
+  pthread_cond_init(&srv->go, NULL);
+  pthread_cond_init(&srv->done, NULL);
+  srv->head = srv->tail = NULL;
+  srv->n = 0;
+  srv->quit = false;
+  memset(srv->count, 0, sizeof(srv->count));
+  srv->served = srv->batches = 0;
+  srv->first = srv->last = 0.0;
+  pthread_create(&srv->th, NULL, batcher, srv);
+  return srv;
+}
+
+void srvdel(Srv* srv) {
+  /* Serve the queued requests, then stop the batching thread and destroy the server, but not its network. */
+  pthread_mutex_lock(&srv->mx);
+  srv->quit = true;
+  pthread_cond_signal(&srv->go);
+  pthread_mutex_unlock(&srv->mx);
+  pthread_join(srv->th, NULL);
+  pthread_cond_destroy(&srv->done);
+  pthread_cond_destroy(&srv->go);
+  pthread_mutex_destroy(&srv->mx);
+  free(srv->scratch);
+  srv->scratch = NULL;
+  free(srv->y);
+  srv->y = NULL;
+  free(srv->x);
+  srv->x = NULL;
+  free(srv);
+}
+
+void srvsubmit(Srv* srv, Req* req) {
+  /* Queue the request; its x must hold the input pattern, and its y room for the output vector. */
+  pthread_mutex_lock(&srv->mx);
+  req->done = false;
+  req->next = NULL;
+  req->t0 = now();
+  if (srv->first == 0.0) srv->first = req->t0;
+  if (srv->tail == NULL) srv->head = req;
+  else srv->tail->next = req;
+  srv->tail = req;
+  srv->n++;
+  if (srv->n == 1 || srv->n >= srv->B) pthread_cond_signal(&srv->go); // the batcher waits for the first request, or for a full batch
+  pthread_mutex_unlock(&srv->mx);
+}
+
+void srvwait(Srv* srv, Req* req) {
+  /* Wait until the request has been served. */
+  pthread_mutex_lock(&srv->mx);
+  while (!req->done) pthread_cond_wait(&srv->done, &srv->mx);
+  pthread_mutex_unlock(&srv->mx);
+}
+
+static double percentile(const Srv* srv, double q) {
+  /* Latency (in microseconds) below which the fraction q of the requests were served; the upper edge of its histogram bucket. */
+  if (srv->served == 0) return 0.0;
+  const long k = (long) ceil(q * srv->served);
+  long c = 0;
+  for (int b = 0; b < LB; b++) {
+    c += srv->count[b];
+    if (c >= k) return exp2((b + 1) / 8.0);
+  }
+  return exp2(LB / 8.0);
+}
+
+void srvreport(Srv* srv, FILE* fo) {
+  /* Report the number of requests served, the throughput, the mean batch size, and the median and 99th percentile latencies. */
+  pthread_mutex_lock(&srv->mx);
+  const double t = srv->last - srv->first;
+  fprintf(fo, "serve %s\n", srv->ebp->name);
+  fprintf(fo, "  n = %-10ld  qps = %-10.1f  batch = %-10.2f  p50 = %.0f us  p99 = %.0f us\n",
+          srv->served, t > 0.0 ? srv->served / t : 0.0, srv->batches > 0 ? (double) srv->served / srv->batches : 0.0,
+          percentile(srv, 0.50), percentile(srv, 0.99));
+  pthread_mutex_unlock(&srv->mx);
+}
@@ -0,0 +1,50 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_SRV_H
+#define NN_SRV_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "lir.h"
+
+#define LB 512 // number of latency histogram buckets; 8 per power of two of microseconds
+
+typedef struct Req {
+  double* x; // input pattern of I taps
+  double* y; // output vector of N[L-1] activations, written by the server
+  double t0; // arrival time (in seconds)
+  bool done; // y is ready
+  struct Req* next; // next request in the queue
+} Req;
+
+typedef struct Srv { // serves one network, one batch at a time
+  Ebp* ebp; // network; read only
+  int B; // largest batch
+  double window; // longest wait (in seconds) of the oldest request for the batch to fill
+  double* x; // batch input matrix x[b * I + i]
+  double* y; // batch output matrix y[b * N[L-1] + j]
+  double* scratch; // predict() scratch space
+  pthread_t th; // batching thread
+  pthread_mutex_t mx; // guards the fields below
+  pthread_cond_t go; // signals a new request, or quit, to the batching thread
+  pthread_cond_t done; // signals finished requests to their waiters
+  Req* head; // oldest queued request
+  Req* tail; // newest queued request
+  int n; // number of queued requests
+  bool quit; // batching thread exits once the queue is empty
+  long count[LB]; // latency histogram; count[b] requests took about 2^(b / 8) microseconds
+  long served; // number of requests served
+  long batches; // number of batches fed forward
+  double first; // arrival time of the first request
+  double last; // finish time of the last request
+} Srv;
+
+extern Srv* srvnew(Ebp* ebp, int B, double window);
+extern void srvdel(Srv* srv);
+extern void srvsubmit(Srv* srv, Req* req);
+extern void srvwait(Srv* srv, Req* req);
+extern void srvreport(Srv* srv, FILE* fo);
+
+#endif // NN_SRV_H
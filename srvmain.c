@@ -0,0 +1,311 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * nnserve: serve scoring requests with networks saved by ./lir -s netname.
+ * A request is one line, the network name followed by the input pattern, "netname,i1,i2,...", and its response is one line, "o1,o2,...", or "ERROR ...".
+ * A client may send requests without waiting for their responses; the responses come back in the order of the requests.
+ * Without -s, the server reads requests from stdin and writes responses to stdout; with -s, it accepts any number of clients on a Unix domain socket.
+ * On end of input, SIGINT, or SIGTERM, the server stops reading requests, answers those in flight, joins its threads, reports its latencies and
+ * throughput on stderr, and exits; on SIGUSR1, it reports and carries on. */
+
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <libc.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "csv.h"
+#include "lir.h"
+#include "srv.h"
+
+typedef struct Pend { // request awaiting its response
+  Req req;
+  Srv* srv; // server of the request; NULL for a malformed request
+  char err[FLDSIZ]; // error message of a malformed request
+  struct Pend* next;
+} Pend;
+
+typedef struct Session { // one client's stream of requests
+  FILE* in; // requests
+  FILE* out; // responses
+  pthread_mutex_t mx; // guards the fields below
+  pthread_cond_t more; // signals a new pending request, or end of input, to the writer
+  Pend* head; // oldest pending request
+  Pend* tail; // newest pending request
+  bool eof; // no more requests
+} Session;
+
+typedef struct Client { // one socket client's thread
+  pthread_t th;
+  int fd; // socket; -1 once the session is over
+  struct Client* next;
+} Client;
+
+static int S = 0; // number of networks
+static Ebp** net = NULL; // networks net[s]
+static Srv** srv = NULL; // servers srv[s]
+static const char* path = NULL; // socket path
+static int ls = -1; // listening socket; guarded by cmx
+static pthread_t top; // main thread, which reads stdin or accepts the clients
+static atomic_bool stop = false; // SIGINT or SIGTERM received; read no more requests
+static atomic_bool out = false; // the main thread no longer blocks on input
+static pthread_mutex_t cmx = PTHREAD_MUTEX_INITIALIZER; // guards clients
+static Client* clients = NULL; // socket clients, newest first
+
+static Pend* parse(char* line) {
+  /* Parse the request line into a pending request. */
+  Pend* pd = calloc(1, sizeof(Pend));
+  line[strcspn(line, "\r\n")] = '\0';
+  char* t = strchr(line, ',');
+  if (t != NULL) *t++ = '\0';
+  for (int s = 0; s < S; s++)
+    if (strcmp(line, net[s]->name) == 0) pd->srv = srv[s];
+  if (pd->srv == NULL) {
+    snprintf(pd->err, sizeof(pd->err), "ERROR: unknown network %.64s", line);
+    return pd;
+  }
+  const Ebp* ebp = pd->srv->ebp;
+  pd->req.x = malloc(ebp->I * sizeof(double));
+  pd->req.y = malloc(ebp->N[ebp->L - 1] * sizeof(double));
+  int i = 0;
+  for (char* e; t != NULL && *t != '\0' && i < ebp->I; i++, t = *e == ',' ? e + 1 : e) {
+    pd->req.x[i] = strtod(t, &e);
+    if (e == t) break;
+  }
+  if (i != ebp->I || (t != NULL && *t != '\0')) {
+    snprintf(pd->err, sizeof(pd->err), "ERROR: %s takes %d input taps", ebp->name, ebp->I);
+    pd->srv = NULL;
+  }
+  return pd;
+}
+
+static void unpend(Pend* pd) {
+  free(pd->req.y);
+  free(pd->req.x);
+  free(pd);
+}
+
+static void* writer(void* arg) {
+  /* Write the responses of the session's requests, in order. */
+  Session* ss = arg;
+  pthread_mutex_lock(&ss->mx);
+  for (;;) {
+    while (ss->head == NULL && !ss->eof) pthread_cond_wait(&ss->more, &ss->mx);
+    Pend* pd = ss->head;
+    if (pd == NULL) break; // end of input
+    ss->head = pd->next;
+    if (ss->head == NULL) ss->tail = NULL;
+    pthread_mutex_unlock(&ss->mx);
+    if (pd->srv == NULL) fprintf(ss->out, "%s\n", pd->err);
+    else {
+      srvwait(pd->srv, &pd->req);
+      const int K = pd->srv->ebp->N[pd->srv->ebp->L - 1];
+      for (int j = 0; j < K; j++) fprintf(ss->out, "%s%.8g", j == 0 ? "" : ",", pd->req.y[j]);
+      fprintf(ss->out, "\n");
+    }
+    pthread_mutex_lock(&ss->mx);
+    if (ss->head == NULL) fflush(ss->out); // flush once the client has no more requests in flight
+    unpend(pd);
+  }
+  pthread_mutex_unlock(&ss->mx);
+  fflush(ss->out);
+  return NULL;
+}
+
+static void session(FILE* in, FILE* out) {
+  /* Read the client's requests and queue them, while a writer thread returns their responses. */
+  Session ss = {.in = in, .out = out, .head = NULL, .tail = NULL, .eof = false};
+  pthread_mutex_init(&ss.mx, NULL);
+  pthread_cond_init(&ss.more, NULL);
+  pthread_t th;
+  pthread_create(&th, NULL, writer, &ss);
+  char line[RECSIZ];
+  for (;;) {
+    if (fgets(line, sizeof(line), in) == NULL) {
+      if (ferror(in) && errno == EINTR && !atomic_load(&stop)) { // a stray signal; read on
+        clearerr(in);
+        continue;
+      }
+      break;
+    }
+    if (atomic_load(&stop)) break; // perhaps a partial line, cut short by the stop
+    if (line[0] == '\n' || line[0] == '\r') continue;
+    Pend* pd = parse(line);
+    pthread_mutex_lock(&ss.mx);
+    if (ss.tail == NULL) ss.head = pd;
+    else ss.tail->next = pd;
+    ss.tail = pd;
+    pthread_cond_signal(&ss.more);
+    pthread_mutex_unlock(&ss.mx);
+    if (pd->srv != NULL) srvsubmit(pd->srv, &pd->req); // after queueing it, lest the writer free it first
+  }
+  pthread_mutex_lock(&ss.mx);
+  ss.eof = true;
+  pthread_cond_signal(&ss.more);
+  pthread_mutex_unlock(&ss.mx);
+  pthread_join(th, NULL);
+  pthread_cond_destroy(&ss.more);
+  pthread_mutex_destroy(&ss.mx);
+}
+
+static void* client(void* arg) {
+  /* Serve one socket client. */
+  Client* cl = arg;
+  FILE* in = fdopen(cl->fd, "r");
+  FILE* fo = fdopen(dup(cl->fd), "w");
+  session(in, fo);
+  pthread_mutex_lock(&cmx);
+  cl->fd = -1; // before the socket closes, lest a stop shut down a reused descriptor
+  pthread_mutex_unlock(&cmx);
+  fclose(fo);
+  fclose(in);
+  return NULL;
+}
+
+static void reap(bool all) {
+  /* Join the client threads whose sessions are over, or all of them. */
+  pthread_mutex_lock(&cmx);
+  for (Client** c = &clients; *c != NULL;) {
+    Client* cl = *c;
+    if (!all && cl->fd >= 0) {
+      c = &cl->next;
+      continue;
+    }
+    *c = cl->next;
+    pthread_mutex_unlock(&cmx);
+    pthread_join(cl->th, NULL);
+    free(cl);
+    pthread_mutex_lock(&cmx);
+  }
+  pthread_mutex_unlock(&cmx);
+}
+
+static void report(void) {
+  for (int s = 0; s < S; s++) srvreport(srv[s], stderr);
+}
+
+static void wake(int sig) {
+  /* Interrupt the main thread's blocking read; see watcher(). */
+}
+
+static void* watcher(void* arg) {
+  /* Handle the signals on behalf of all threads; on SIGINT or SIGTERM, stop the input, and return.
+   * The clients' sockets and the listening socket are shut down for reading, so their reads and accept() return, while stdin, which cannot be
+   * shut down, is interrupted by SIGUSR2 until the main thread is out of its read. */
+  sigset_t* set = arg;
+  int sig;
+  do {
+    sigwait(set, &sig);
+    if (sig == SIGUSR1) report();
+  } while (sig == SIGUSR1);
+  atomic_store(&stop, true);
+  pthread_mutex_lock(&cmx);
+  for (Client* cl = clients; cl != NULL; cl = cl->next)
+    if (cl->fd >= 0) shutdown(cl->fd, SHUT_RD);
+  if (ls >= 0) shutdown(ls, SHUT_RDWR);
+  pthread_mutex_unlock(&cmx);
+  while (!atomic_load(&out)) {
+    pthread_kill(top, SIGUSR2);
+    nanosleep(&(struct timespec) {.tv_sec = 0, .tv_nsec = 10000000}, NULL); // 10 ms; the signal may land just before the read
+  }
+  return NULL;
+}
+
+static void listener(void) {
+  /* Accept clients on the Unix domain socket, one thread each. */
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    fprintf(stderr, "ERROR: socket path %s is too long\n", path);
+    exit(1);
+  }
+  strcpy(sa.sun_path, path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (fd < 0 || bind(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0 || listen(fd, 64) != 0) {
+    fprintf(stderr, "ERROR: cannot listen on socket %s\n", path);
+    exit(1);
+  }
+  pthread_mutex_lock(&cmx);
+  ls = fd;
+  const bool early = atomic_load(&stop); // stopped before the socket could be shut down
+  pthread_mutex_unlock(&cmx);
+  while (!early && !atomic_load(&stop)) {
+    const int cs = accept(ls, NULL, NULL);
+    if (cs < 0) continue; // interrupted, or shut down by a stop
+    Client* cl = malloc(sizeof(Client));
+    cl->fd = cs;
+    pthread_mutex_lock(&cmx);
+    if (atomic_load(&stop)) shutdown(cs, SHUT_RD); // accepted as the stop came; answer what the client has already sent
+    cl->next = clients;
+    clients = cl;
+    pthread_create(&cl->th, NULL, client, cl);
+    pthread_mutex_unlock(&cmx);
+    reap(false);
+  }
+  reap(true);
+  pthread_mutex_lock(&cmx);
+  close(ls);
+  ls = -1;
+  pthread_mutex_unlock(&cmx);
+  unlink(path);
+}
+
+int main(int argc, const char** argv) {
+  int B = 64; // largest batch
+  double window = 200.0e-6; // batching window (in seconds)
+  int a = 1;
+  for (; a + 1 < argc && argv[a][0] == '-'; a += 2) {
+    if (strcmp(argv[a], "-s") == 0) path = argv[a + 1];
+    else if (strcmp(argv[a], "-b") == 0) B = atoi(argv[a + 1]);
+    else if (strcmp(argv[a], "-w") == 0) window = atof(argv[a + 1]) * 1.0e-6;
+    else break;
+  }
+  if (a >= argc || argv[a][0] == '-') {
+    fprintf(stderr, "Usage: %s [-s socket] [-b batch] [-w window (in microseconds)] netname...\n", argv[0]);
+    exit(1);
+  }
+  // handle the signals in one thread; every thread, including the batching threads, inherits the mask
+  static sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  signal(SIGPIPE, SIG_IGN); // a client that hangs up only ends its own session
+  struct sigaction sw = {.sa_handler = wake}; // without SA_RESTART, so that the main thread's read returns
+  sigemptyset(&sw.sa_mask);
+  sigaction(SIGUSR2, &sw, NULL);
+  top = pthread_self();
+  // load the networks once
+  char cwd[FLDSIZ];
+  getcwd(cwd, sizeof(cwd)); // current working directory
+  S = argc - a;
+  net = malloc(S * sizeof(Ebp*));
+  srv = malloc(S * sizeof(Srv*));
+  for (int s = 0; s < S; s++) {
+    char buf[FLDSIZ];
+    sprintf(buf, "%s/dat/%s.ebp", cwd, argv[a + s]);
+    net[s] = ebpload(buf);
+    srv[s] = srvnew(net[s], B, window);
+    fprintf(stderr, "load %s\n", buf);
+  }
+  pthread_t th;
+  pthread_create(&th, NULL, watcher, &set);
+  if (path != NULL) listener();
+  else session(stdin, stdout);
+  atomic_store(&out, true);
+  pthread_kill(th, SIGTERM); // ends the watcher, unless a stop already has
+  pthread_join(th, NULL);
+  for (int s = 0; s < S; s++) {
+    srvreport(srv[s], stderr);
+    srvdel(srv[s]);
+    srv[s] = NULL;
+    ebpdel(net[s]);
+    net[s] = NULL;
+  }
+  free(srv);
+  srv = NULL;
+  free(net);
+  net = NULL;
+  return 0;
+}
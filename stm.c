@@ -0,0 +1,181 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Out-of-core pattern stream, for data sets larger than memory.
+ * The patterns are read in chunks of Q by a prefetch thread, into one of two buffers, while the trainer uses the other.
+ * Shuffling the chunk order and the patterns within each chunk replaces shuffling the whole data set, so no cycle needs random access to single patterns.
+ * Memory holds two chunks and the file offset of every chunk, whatever the number of patterns. */
+
+#include <string.h>
+#include <stdlib.h>
+#include "csv.h"
+#include "etc.h"
+#include "stm.h"
+
+static FILE* openpat(const char* file) {
+  FILE* fi = fopen(file, "r");
+  if (fi == NULL) {
+    fprintf(stderr, "ERROR: cannot load CSV file %s\n", file);
+    exit(1);
+  }
+  return fi;
+}
+
+static void locate(FILE* fi, const char* file, int P, int Q, long* off) {
+  /* Record the file offset off[k] of every chunk of Q patterns, in one sequential pass.
+   * The records are read whole, whatever their length, so that a long record is not taken for several. */
+  char* rec = NULL; // getline() buffer
+  size_t cap = 0;
+  for (int p = 0; p < P; p++) {
+    if (p % Q == 0) off[p / Q] = ftell(fi);
+    if (getline(&rec, &cap, fi) < 0) {
+      fprintf(stderr, "ERROR: cannot load all the records from CSV file %s\n", file);
+      exit(1);
+    }
+  }
+  free(rec);
+}
+
+static void parse(FILE* fi, long off, int n, int F, double* x) {
+  /* Read n records of F numbers from the file offset off into x. */
+  char* rec = NULL; // getline() buffer
+  size_t cap = 0;
+  fseek(fi, off, SEEK_SET);
+  for (int p = 0; p < n; p++) {
+    if (getline(&rec, &cap, fi) < 0) { // indexed, so cannot happen unless the file shrinks
+      fprintf(stderr, "ERROR: cannot reload a record from a CSV file\n");
+      exit(1);
+    }
+    char* s = rec;
+    for (int j = 0; j < F; j++) {
+      char* e;
+      x[p * F + j] = strtod(s, &e);
+      s = *e == ',' ? e + 1 : e;
+    }
+  }
+  free(rec);
+}
+
+static void fill(Stream* st, int b, int k) {
+  /* Read chunk k into buffer b, and order its patterns. */
+  Chunk* ch = &st->buf[b];
+  ch->n = k < st->K - 1 ? st->Q : st->P - k * st->Q; // last chunk may be short
+  parse(st->fi, st->io[k], ch->n, st->I, ch->x);
+  parse(st->ft, st->to[k], ch->n, st->O, ch->t);
+  for (int p = 0; p < ch->n; p++) ch->perm[p] = p;
+  if (st->shuffle) shuffler(ch->n, ch->perm, &st->seed);
+  for (int p = 0; p < ch->n; p++) {
+    ch->ii[p] = ch->x + ch->perm[p] * st->I;
+    ch->tt[p] = ch->t + ch->perm[p] * st->O;
+  }
+}
+
+static void* prefetch(void* arg) {
+  /* Read the chunks of cycle after cycle, each cycle in a new order, one chunk ahead of the trainer. */
+  Stream* st = arg;
+  pthread_mutex_lock(&st->mx);
+  for (int k = 0; !st->quit; k = (k + 1) % st->K) {
+    if (k == 0 && st->shuffle) shuffler(st->K, st->order, &st->seed); // new cycle
+    while (!st->quit && st->full[st->w]) pthread_cond_wait(&st->cv, &st->mx);
+    if (st->quit) break;
+    const int b = st->w;
+    pthread_mutex_unlock(&st->mx);
+    fill(st, b, st->order[k]); // the trainer does not touch buffer b until it is full
+    pthread_mutex_lock(&st->mx);
+    st->full[b] = true;
+    st->w = 1 - b;
+    pthread_cond_broadcast(&st->cv);
+  }
+  pthread_mutex_unlock(&st->mx);
+  return NULL;
+}
+
+Stream* stmnew(const char* ifile, const char* tfile, int P, int I, int O, int Q, bool shuffle) {
+  /* Create a stream of P patterns, each of I input taps and O targets, in chunks of Q, and start prefetching the first chunk. */
+  Stream* st = malloc(sizeof(Stream));
+  st->fi = openpat(ifile);
+  st->ft = openpat(tfile);
+  st->P = P;
+  st->I = I;
+  st->O = O;
+  st->Q = Q < 1 ? 1 : Q > P ? P : Q;
+  st->K = (P + st->Q - 1) / st->Q;
+  st->shuffle = shuffle;
+  st->io = malloc(st->K * sizeof(long));
+  st->to = malloc(st->K * sizeof(long));
+  locate(st->fi, ifile, P, st->Q, st->io);
+  locate(st->ft, tfile, P, st->Q, st->to);
+  st->order = malloc(st->K * sizeof(int));
+  for (int k = 0; k < st->K; k++) st->order[k] = k;
+  st->seed = (unsigned int) rnd();
+  for (int b = 0; b < 2; b++) {
+    Chunk* ch = &st->buf[b];
+    ch->n = 0;
+    ch->x = malloc((size_t) st->Q * I * sizeof(double));
+    ch->t = malloc((size_t) st->Q * O * sizeof(double));
+    ch->ii = malloc(st->Q * sizeof(double*));
+    ch->tt = malloc(st->Q * sizeof(double*));
+    ch->perm = malloc(st->Q * sizeof(int));
+    st->full[b] = false;
+  }
+  pthread_mutex_init(&st->mx, NULL);
+  pthread_cond_init(&st->cv, NULL);
+  st->w = st->r = 0;
+  st->held = -1;
+  st->got = 0;
+  st->quit = false;
+  pthread_create(&st->th, NULL, prefetch, st);
+  return st;
+}
+
+void stmdel(Stream* st) {
+  /* Stop prefetching and destroy the stream. */
+  pthread_mutex_lock(&st->mx);
+  st->quit = true;
+  pthread_cond_broadcast(&st->cv);
+  pthread_mutex_unlock(&st->mx);
+  pthread_join(st->th, NULL);
+  pthread_cond_destroy(&st->cv);
+  pthread_mutex_destroy(&st->mx);
+  for (int b = 0; b < 2; b++) {
+    Chunk* ch = &st->buf[b];
+    free(ch->perm);
+    free(ch->tt);
+    free(ch->ii);
+    free(ch->t);
+    free(ch->x);
+  }
+  free(st->order);
+  st->order = NULL;
+  free(st->to);
+  st->to = NULL;
+  free(st->io);
+  st->io = NULL;
+  fclose(st->ft);
+  fclose(st->fi);
+  free(st);
+}
+
+int stmnext(Stream* st, double*** ii, double*** tt) {
+  /* Release the previous chunk, and wait for the next chunk of the cycle.
+   * Return its number of patterns, and point ii and tt to its patterns in presentation order; valid until the next call.
+   * Return 0 at the end of each cycle; the call after that starts the next cycle. */
+  pthread_mutex_lock(&st->mx);
+  if (st->held >= 0) {
+    st->full[st->held] = false;
+    st->held = -1;
+    pthread_cond_broadcast(&st->cv);
+  }
+  if (st->got == st->K) {
+    st->got = 0;
+    pthread_mutex_unlock(&st->mx);
+    return 0;
+  }
+  while (!st->full[st->r]) pthread_cond_wait(&st->cv, &st->mx);
+  st->held = st->r;
+  st->r = 1 - st->r;
+  st->got++;
+  pthread_mutex_unlock(&st->mx);
+  *ii = st->buf[st->held].ii;
+  *tt = st->buf[st->held].tt;
+  return st->buf[st->held].n;
+}
@@ -0,0 +1,49 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_STM_H
+#define NN_STM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct Chunk {
+  int n; // number of patterns
+  double* x; // input patterns x[p * I + i], in file order
+  double* t; // target patterns t[p * O + j], in file order
+  double** ii; // input patterns ii[p], in presentation order; pointers ii[p] -> x
+  double** tt; // associated target patterns tt[p]; pointers tt[p] -> t
+  int* perm; // presentation order
+} Chunk;
+
+typedef struct Stream { // input and target patterns read from their CSV files one chunk at a time
+  FILE* fi; // input pattern file
+  FILE* ft; // target pattern file
+  int P; // number of patterns
+  int I; // number of input taps
+  int O; // number of output nodes
+  int Q; // number of patterns per chunk
+  int K; // number of chunks
+  bool shuffle; // shuffle the chunk order, and the pattern order within each chunk, every cycle
+  long* io; // file offset io[k] of chunk k in the input pattern file
+  long* to; // file offset to[k] of chunk k in the target pattern file
+  int* order; // chunk presentation order; written by the prefetch thread only
+  unsigned int seed; // random seed of the prefetch thread
+  Chunk buf[2]; // double buffer; the prefetch thread fills one while the trainer uses the other
+  pthread_t th; // prefetch thread
+  pthread_mutex_t mx; // guards the fields below
+  pthread_cond_t cv; // signals a filled or an emptied buffer
+  bool full[2]; // buf[b] holds a chunk that the trainer has not finished
+  int w; // buffer that the prefetch thread fills next
+  int r; // buffer that the trainer uses next
+  int held; // buffer that the trainer is using; -1 when none
+  int got; // number of chunks of the current cycle handed to the trainer
+  bool quit; // prefetch thread exits
+} Stream;
+
+extern Stream* stmnew(const char* ifile, const char* tfile, int P, int I, int O, int Q, bool shuffle);
+extern void stmdel(Stream* st);
+extern int stmnext(Stream* st, double*** ii, double*** tt);
+
+#endif // NN_STM_H
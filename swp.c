@@ -0,0 +1,228 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * Hyperparameter sweeps: every combination of the values listed for some configuration columns is a trial, and the trials run concurrently on a thread pool.
+ * Trials differ widely in length, so each thread takes its trials from its own share, and steals from the largest remaining share once its own runs out.
+ * A trial that is losing badly to the trials before it in grid order, at the same fraction of its training cycles, is stopped early.
+ * To cull the same trials on any number of threads, the trials then start in grid order, and each waits at a checkpoint until every earlier trial
+ * has passed it, or ended; the earliest unfinished trial never waits, so the sweep always moves on. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+#include <unistd.h>
+#include "etc.h"
+#include "swp.h"
+
+static int values(const char* s, char*** val) {
+  /* Parse the axis field formatted as "a;b..." into *val, and return the number of values; a value formatted as "lo:step:hi" stands for the range lo, lo + step, .. hi. */
+  char buf[FLDSIZ];
+  strcpy(buf, s);
+  int n = 0;
+  char** v = NULL;
+  char* z; // strtok_r() state
+  for (char* t, * u = buf; (t = strtok_r(u, ";", &z)) != NULL; u = NULL) {
+    double lo, step, hi;
+    if (sscanf(t, "%lf:%lf:%lf", &lo, &step, &hi) == 3 && step > 0.0) {
+      for (int m = 0; lo + m * step <= hi + step * 1.0e-9; m++) { // tolerate the rounding of the last step
+        v = realloc(v, (n + 1) * sizeof(char*));
+        char w[FLDSIZ];
+        snprintf(w, sizeof(w), "%g", lo + m * step);
+        v[n++] = strndup(w, FLDSIZ); // malloc()
+      }
+    } else {
+      v = realloc(v, (n + 1) * sizeof(char*));
+      v[n++] = strndup(t, FLDSIZ); // malloc()
+    }
+  }
+  *val = v;
+  return n;
+}
+
+Sweep* sweepnew(const char* name, const char* file, Run run) {
+  /* Create the sweep of the network name over the grid in file.
+   * The grid file has a header record of column names and one record of their values, separated by ";" or given as "lo:step:hi" ranges.
+   * Every column but threads and cull is an axis of the grid; the seed axis holds the random seeds, and the others override the network's configuration columns.
+   * The trials run concurrently, so each trains on one thread; T cannot be an axis.
+   * run: trial runner */
+  Csv* csv = csvnew(file);
+  csvload(csv);
+  Sweep* sw = malloc(sizeof(Sweep));
+  sw->name = strndup(name, FLDSIZ); // malloc()
+  sw->run = run;
+  sw->T = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  sw->cull = 0.0;
+  sw->A = 0;
+  sw->axis = malloc(csv->F * sizeof(char*));
+  sw->n = malloc(csv->F * sizeof(int));
+  sw->val = malloc(csv->F * sizeof(char**));
+  for (int f = 0; f < csv->F; f++) {
+    const char* col = csv->r[0][f];
+    if (strcmp(col, "threads") == 0) sw->T = atoi(csv->r[1][f]);
+    else if (strcmp(col, "cull") == 0) sw->cull = atof(csv->r[1][f]);
+    else if (strcmp(col, "T") == 0) {
+      fprintf(stderr, "ERROR: sweep %s cannot sweep T; each trial trains on one thread\n", name);
+      exit(1);
+    } else {
+      sw->axis[sw->A] = strndup(col, FLDSIZ); // malloc()
+      sw->n[sw->A] = values(csv->r[1][f], &sw->val[sw->A]);
+      sw->A++;
+    }
+  }
+  csvdel(csv);
+  csv = NULL;
+  if (sw->T < 1) sw->T = 1;
+  // lay out the grid; the last axis varies fastest
+  sw->K = 1;
+  for (int a = 0; a < sw->A; a++) sw->K *= sw->n[a];
+  sw->tr = malloc(sw->K * sizeof(Trial));
+  for (int k = 0; k < sw->K; k++) {
+    Trial* tr = &sw->tr[k];
+    *tr = (Trial) {.sw = sw, .k = k, .e = DBL_MAX, .c = 0, .z = 0, .secs = 0.0, .culled = false, .ended = false};
+    tr->v = malloc(sw->A * sizeof(char*));
+    tr->seed = (unsigned int) rnd(); // unless there is a seed axis
+    for (int a = sw->A - 1, r = k; a >= 0; r /= sw->n[a], a--) {
+      tr->v[a] = sw->val[a][r % sw->n[a]];
+      if (strcmp(sw->axis[a], "seed") == 0) tr->seed = (unsigned int) atol(tr->v[a]);
+    }
+  }
+  sw->st = NULL;
+  sw->next = 0;
+  pthread_mutex_init(&sw->mx, NULL);
+  pthread_cond_init(&sw->cv, NULL);
+  return sw;
+}
+
+void sweepdel(Sweep* sw) {
+  /* Destroy the sweep. */
+  pthread_cond_destroy(&sw->cv);
+  pthread_mutex_destroy(&sw->mx);
+  for (int k = 0; k < sw->K; k++) free(sw->tr[k].v);
+  free(sw->tr);
+  sw->tr = NULL;
+  for (int a = 0; a < sw->A; a++) {
+    for (int m = 0; m < sw->n[a]; m++) free(sw->val[a][m]);
+    free(sw->val[a]);
+    free(sw->axis[a]);
+  }
+  free(sw->val);
+  sw->val = NULL;
+  free(sw->n);
+  sw->n = NULL;
+  free(sw->axis);
+  sw->axis = NULL;
+  free(sw->name);
+  sw->name = NULL;
+  free(sw);
+}
+
+void sweepapply(const Trial* tr, Csv* cfgcsv) {
+  /* Override the network's configuration with the trial's values, and train it on one thread, lest the trials' threads oversubscribe the processors. */
+  const Sweep* sw = tr->sw;
+  for (int a = 0; a < sw->A; a++) {
+    if (strcmp(sw->axis[a], "seed") == 0) continue;
+    if (!csvput(cfgcsv, 1, sw->axis[a], tr->v[a])) {
+      fprintf(stderr, "ERROR: network %s has no configuration column %s to sweep\n", sw->name, sw->axis[a]);
+      exit(1);
+    }
+  }
+  csvput(cfgcsv, 1, "T", "1"); // if the network has a T column
+}
+
+static bool behind(const Sweep* sw, int k, int z) {
+  /* Check if some trial before trial k has yet to pass checkpoint z, or to end. */
+  for (int j = 0; j < k; j++)
+    if (!sw->tr[j].ended && sw->tr[j].z < z) return true;
+  return false;
+}
+
+bool sweepwatch(void* watcher, int c, int C, double e) {
+  /* Watch the trial's training, and stop it if it is losing; see Watch. */
+  Trial* tr = watcher;
+  Sweep* sw = tr->sw;
+  tr->c = c + 1;
+  tr->e = e;
+  const int z = (int) ((long) (c + 1) * CHECKS / C); // latest checkpoint passed
+  if (z == tr->z) return true;
+  pthread_mutex_lock(&sw->mx);
+  for (int y = tr->z + 1; y <= z; y++) tr->ze[y] = e; // a short training may pass several checkpoints at once
+  tr->z = z;
+  pthread_cond_broadcast(&sw->cv);
+  if (sw->cull > 0.0 && z >= WARMUP) {
+    while (behind(sw, tr->k, z)) pthread_cond_wait(&sw->cv, &sw->mx);
+    double best = DBL_MAX; // best error of the earlier trials that passed checkpoint z
+    for (int j = 0; j < tr->k; j++)
+      if (sw->tr[j].z >= z && sw->tr[j].ze[z] < best) best = sw->tr[j].ze[z];
+    if (e > sw->cull * best) tr->culled = true;
+  }
+  pthread_mutex_unlock(&sw->mx);
+  return !tr->culled;
+}
+
+static void row(FILE* fo, const Sweep* sw, const Trial* tr) {
+  /* Write the trial's summary record. */
+  fprintf(fo, "%d", tr->k);
+  for (int a = 0; a < sw->A; a++)
+    if (strcmp(sw->axis[a], "seed") != 0) fprintf(fo, ",%s", tr->v[a]);
+  fprintf(fo, ",%u,%.8f,%d,%.3f,%s\n", tr->seed, tr->e, tr->c, tr->secs, tr->culled ? "TRUE" : "FALSE");
+}
+
+static void header(FILE* fo, const Sweep* sw) {
+  /* Write the summary header record. */
+  fprintf(fo, "trial");
+  for (int a = 0; a < sw->A; a++)
+    if (strcmp(sw->axis[a], "seed") != 0) fprintf(fo, ",%s", sw->axis[a]);
+  fprintf(fo, ",seed,e,c,secs,culled\n");
+}
+
+static bool take(Sweep* sw, int t, int* k) {
+  /* Take thread t's next trial k, or return false if there are none left. */
+  if (sw->st != NULL) return stealnext(sw->st, t, k);
+  pthread_mutex_lock(&sw->mx);
+  *k = sw->next < sw->K ? sw->next++ : -1;
+  pthread_mutex_unlock(&sw->mx);
+  return *k >= 0;
+}
+
+static void trials(void* arg, int t) {
+  /* Thread t runs trials until there are none left to run or to steal. */
+  Sweep* sw = arg;
+  for (int k; take(sw, t, &k);) {
+    Trial* tr = &sw->tr[k];
+    rngseed(tr->seed); // the trial's weights and shuffles depend on its seed only, not on which thread runs it, nor when
+    const double t0 = now();
+    sw->run(sw->name, tr);
+    tr->secs = now() - t0;
+    pthread_mutex_lock(&sw->mx);
+    tr->ended = true;
+    pthread_cond_broadcast(&sw->cv);
+    row(stdout, sw, tr);
+    fflush(stdout);
+    pthread_mutex_unlock(&sw->mx);
+  }
+}
+
+void sweeprun(Sweep* sw, const char* file) {
+  /* Run all the trials, print each one's summary record as it ends, and save all the summary records into file in trial order. */
+  printf("sweep %s (%d trials on %d threads)\n", sw->name, sw->K, sw->T);
+  header(stdout, sw);
+  Pool* pool = poolnew(sw->T);
+  sw->st = sw->cull > 0.0 ? NULL : stealnew(sw->T, sw->K); // culling waits on the earlier trials, so they must have started
+  poolrun(pool, trials, sw);
+  if (sw->st != NULL) stealdel(sw->st);
+  sw->st = NULL;
+  pooldel(pool);
+  pool = NULL;
+  FILE* fo = fopen(file, "w");
+  if (fo == NULL) {
+    fprintf(stderr, "ERROR: cannot save CSV file %s\n", file);
+    exit(1);
+  }
+  header(fo, sw);
+  for (int k = 0; k < sw->K; k++) row(fo, sw, &sw->tr[k]);
+  fclose(fo);
+  int b = 0; // best trial
+  for (int k = 1; k < sw->K; k++)
+    if (sw->tr[k].e < sw->tr[b].e) b = k;
+  printf("best trial %d  e = %-10.8f\n", b, sw->tr[b].e);
+}
@@ -0,0 +1,54 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_SWP_H
+#define NN_SWP_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "csv.h"
+#include "thr.h"
+
+#define CHECKS 10 // number of checkpoints over a trial's training cycles at which losing trials are culled
+#define WARMUP 2 // number of checkpoints before the first cull
+
+typedef struct Trial { // one point of the sweep grid
+  struct Sweep* sw; // sweep to which the trial belongs
+  int k; // trial number
+  const char** v; // value v[a] of sweep axis a
+  unsigned int seed; // random seed
+  double e; // latest training error
+  int c; // number of cycles trained
+  int z; // latest checkpoint passed
+  double ze[CHECKS + 1]; // training error ze[z] at checkpoint z, for z up to the latest passed
+  double secs; // wall time (in seconds)
+  bool culled; // stopped early, for losing to the earlier trials
+  bool ended; // no longer training
+} Trial;
+
+typedef void (* Run)(const char* name, Trial* tr); // train the network described by dat/"name".csv, with the trial's values
+
+typedef struct Sweep { // grid of trials of one network, run concurrently
+  char* name; // network name
+  Run run; // trial runner
+  int A; // number of axes
+  char** axis; // name axis[a] of axis a; a column of the network's configuration, or seed
+  int* n; // number of values n[a] along axis a
+  char*** val; // value val[a][m] along axis a
+  int K; // number of trials
+  Trial* tr; // trials tr[k]
+  int T; // number of threads
+  double cull; // a trial whose error exceeds cull times the best error of the earlier trials at the same checkpoint stops; 0 never culls
+  Steal* st; // trial scheduler; NULL when culling, which starts the trials in grid order
+  int next; // next trial to start when culling
+  pthread_mutex_t mx; // guards the trials' checkpoints, next, and the summary output
+  pthread_cond_t cv; // signals a trial's new checkpoint, or its end, to the later trials waiting on it
+} Sweep;
+
+extern Sweep* sweepnew(const char* name, const char* file, Run run);
+extern void sweepdel(Sweep* sw);
+extern void sweeprun(Sweep* sw, const char* file);
+extern void sweepapply(const Trial* tr, Csv* cfgcsv);
+extern bool sweepwatch(void* watcher, int c, int C, double e);
+
+#endif // NN_SWP_H
@@ -0,0 +1,167 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc.
+ * A persistent pool of threads that run the same job, fork-join style.
+ * The threads are created once and sleep between jobs, so a job costs two condition signals, not T thread creations.
+ * Also, a lock-free single-producer, single-consumer queue for handing work from one thread to the next,
+ * and a work-stealing scheduler for tasks of uneven length. */
+
+#include <stdlib.h>
+#include "thr.h"
+
+static void* worker(void* arg) {
+  /* Wait for a job, run it, report its end, and repeat until the pool quits. */
+  Seat* seat = arg;
+  Pool* pool = seat->pool;
+  long gen = 0; // generation of the last job run
+  pthread_mutex_lock(&pool->mx);
+  for (;;) {
+    while (!pool->quit && pool->gen == gen) pthread_cond_wait(&pool->go, &pool->mx);
+    if (pool->quit) break;
+    gen = pool->gen;
+    Job job = pool->job;
+    void* a = pool->arg;
+    pthread_mutex_unlock(&pool->mx);
+    job(a, seat->t);
+    pthread_mutex_lock(&pool->mx);
+    if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mx);
+  return NULL;
+}
+
+Pool* poolnew(int T) {
+  /* Create a pool of T threads; the calling thread is thread 0. */
+  Pool* pool = malloc(sizeof(Pool));
+  pool->T = T < 1 ? 1 : T;
+  pool->th = malloc(pool->T * sizeof(pthread_t));
+  pool->seat = malloc(pool->T * sizeof(Seat));
+  pthread_mutex_init(&pool->mx, NULL);
+  pthread_cond_init(&pool->go, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->job = NULL;
+  pool->arg = NULL;
+  pool->gen = 0;
+  pool->busy = 0;
+  pool->quit = false;
+  for (int t = 1; t < pool->T; t++) {
+    pool->seat[t] = (Seat) {.pool = pool, .t = t};
+    pthread_create(&pool->th[t], NULL, worker, &pool->seat[t]);
+  }
+  return pool;
+}
+
+void pooldel(Pool* pool) {
+  /* Stop the workers and destroy the pool. */
+  pthread_mutex_lock(&pool->mx);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->mx);
+  for (int t = 1; t < pool->T; t++) pthread_join(pool->th[t], NULL);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->go);
+  pthread_mutex_destroy(&pool->mx);
+  free(pool->seat);
+  pool->seat = NULL;
+  free(pool->th);
+  pool->th = NULL;
+  free(pool);
+}
+
+void poolrun(Pool* pool, Job job, void* arg) {
+  /* Run job(arg, t) on every thread t of the pool, and return when all of them have finished. */
+  if (pool->T > 1) {
+    pthread_mutex_lock(&pool->mx);
+    pool->job = job;
+    pool->arg = arg;
+    pool->busy = pool->T - 1;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->go);
+    pthread_mutex_unlock(&pool->mx);
+  }
+  job(arg, 0);
+  if (pool->T > 1) {
+    pthread_mutex_lock(&pool->mx);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->mx);
+    pthread_mutex_unlock(&pool->mx);
+  }
+}
+
+/* single-producer, single-consumer queue */
+
+Spsc* spscnew(int Q) {
+  /* Create a queue that holds at least Q values. */
+  Spsc* spsc = malloc(sizeof(Spsc));
+  for (spsc->Q = 1; spsc->Q < Q; spsc->Q *= 2);
+  spsc->q = malloc(spsc->Q * sizeof(int));
+  atomic_init(&spsc->head, 0);
+  atomic_init(&spsc->tail, 0);
+  return spsc;
+}
+
+void spscdel(Spsc* spsc) {
+  /* Destroy the queue. */
+  free(spsc->q);
+  spsc->q = NULL;
+  free(spsc);
+}
+
+bool spscpush(Spsc* spsc, int v) {
+  /* Append v, unless the queue is full; called by the producer only. */
+  const long t = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+  if (t - atomic_load_explicit(&spsc->head, memory_order_acquire) == spsc->Q) return false;
+  spsc->q[t & (spsc->Q - 1)] = v;
+  atomic_store_explicit(&spsc->tail, t + 1, memory_order_release); // publishes v, and everything written before it
+  return true;
+}
+
+bool spscpop(Spsc* spsc, int* v) {
+  /* Remove the oldest value into v, unless the queue is empty; called by the consumer only. */
+  const long h = atomic_load_explicit(&spsc->head, memory_order_relaxed);
+  if (h == atomic_load_explicit(&spsc->tail, memory_order_acquire)) return false;
+  *v = spsc->q[h & (spsc->Q - 1)];
+  atomic_store_explicit(&spsc->head, h + 1, memory_order_release); // frees the cell for the producer
+  return true;
+}
+
+/* work stealing */
+
+Steal* stealnew(int T, int K) {
+  /* Deal the tasks 0 .. K - 1 out to T threads in contiguous shares. */
+  Steal* st = malloc(sizeof(Steal));
+  st->T = T < 1 ? 1 : T;
+  st->lo = malloc(st->T * sizeof(int));
+  st->hi = malloc(st->T * sizeof(int));
+  for (int t = 0; t < st->T; t++) {
+    st->lo[t] = (int) ((long) K * t / st->T);
+    st->hi[t] = (int) ((long) K * (t + 1) / st->T);
+  }
+  pthread_mutex_init(&st->mx, NULL);
+  return st;
+}
+
+void stealdel(Steal* st) {
+  /* Destroy the scheduler. */
+  pthread_mutex_destroy(&st->mx);
+  free(st->hi);
+  st->hi = NULL;
+  free(st->lo);
+  st->lo = NULL;
+  free(st);
+}
+
+bool stealnext(Steal* st, int t, int* k) {
+  /* Give thread t its next task in k: its own, else one stolen from the thread with the most tasks left; return false when no task is left. */
+  pthread_mutex_lock(&st->mx);
+  if (st->lo[t] == st->hi[t]) { // out of work; steal the top half of the largest share
+    int v = t; // victim
+    for (int u = 0; u < st->T; u++)
+      if (st->hi[u] - st->lo[u] > st->hi[v] - st->lo[v]) v = u;
+    const int n = (st->hi[v] - st->lo[v] + 1) / 2;
+    st->hi[t] = st->hi[v];
+    st->lo[t] = st->hi[v] = st->hi[v] - n;
+  }
+  const bool any = st->lo[t] < st->hi[t];
+  if (any) *k = st->lo[t]++;
+  pthread_mutex_unlock(&st->mx);
+  return any;
+}
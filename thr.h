@@ -0,0 +1,57 @@
+/* Author: Amen Zwa, Esq.
+ * Copyright (c) 2022 sOnit, Inc. */
+
+#ifndef NN_THR_H
+#define NN_THR_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef void (* Job)(void* arg, int t); // job run by thread t of a pool
+
+typedef struct Seat {
+  struct Pool* pool; // pool to which the thread belongs
+  int t; // thread number
+} Seat;
+
+typedef struct Pool {
+  int T; // number of threads, including the calling thread as thread 0
+  pthread_t* th; // worker threads th[t] for t = 1 .. T - 1
+  Seat* seat; // worker thread arguments seat[t]
+  pthread_mutex_t mx; // guards the fields below
+  pthread_cond_t go; // signals a new job to the workers
+  pthread_cond_t done; // signals the end of the job to the caller
+  Job job; // current job
+  void* arg; // current job's argument
+  long gen; // job generation; bumped by each poolrun()
+  int busy; // number of workers still running the current job
+  bool quit; // workers exit
+} Pool;
+
+typedef struct Spsc {
+  int Q; // capacity; a power of two
+  int* q; // ring of queued values
+  _Atomic long head; // number of values popped; written by the consumer only
+  _Atomic long tail; // number of values pushed; written by the producer only
+} Spsc;
+
+typedef struct Steal {
+  int T; // number of threads
+  int* lo; // thread t owns the tasks lo[t] .. hi[t] - 1, and takes them from the bottom
+  int* hi; // thieves take the top half of a victim's tasks
+  pthread_mutex_t mx; // guards lo and hi; tasks are coarse, so one lock suffices
+} Steal;
+
+extern Pool* poolnew(int T);
+extern void pooldel(Pool* pool);
+extern void poolrun(Pool* pool, Job job, void* arg);
+extern Spsc* spscnew(int Q);
+extern void spscdel(Spsc* spsc);
+extern bool spscpush(Spsc* spsc, int v);
+extern bool spscpop(Spsc* spsc, int* v);
+extern Steal* stealnew(int T, int K);
+extern void stealdel(Steal* st);
+extern bool stealnext(Steal* st, int t, int* k);
+
+#endif // NN_THR_H